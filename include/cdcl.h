@@ -0,0 +1,22 @@
+#ifndef CDCL_H
+#define CDCL_H
+
+#include <stdio.h>
+
+#include "grid.h"
+
+/* Conflict-driven engine: a boolean variable tells if a cell has a color,
+   and the rules of sudoku are propagated natively (a color of a cell is
+   removed from its peers, a cell or a unit with one place left for a color
+   gets it), each implication being explained only when a conflict needs
+   it. Conflicts are analysed to learn a nogood (first unique implication
+   point), the search jumps back to the level where it applies, and restarts
+   follow the Luby sequence, keeping what was learnt. Searches like
+   grid_solver() in mode_first, mode_all or mode_unique, incrementing
+   *solution_count for each solution found and writing the last one in the
+   grid. In mode_all, solutions are printed in 'output' as grid_solver()
+   does. */
+void cdcl_search(grid_t *grid, const mode_t mode, search_t *search,
+                 uint64_t *solution_count, FILE *output);
+
+#endif /* CDCL_H */
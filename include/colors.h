@@ -1,70 +1,532 @@
-#define MAX_COLORS 64
+#ifndef COLORS_H
+#define COLORS_H
+
+/* Number of 64-bit words of a color set, set at build time
+   (make COLORS_WORDS=3 for grids up to 169x169) */
+#ifndef COLORS_WORDS
+#define COLORS_WORDS 1
+#endif
+
+#if COLORS_WORDS < 1 || COLORS_WORDS > 3
+#error "COLORS_WORDS must be 1, 2 or 3"
+#endif
+
+#define MAX_COLORS (64 * COLORS_WORDS)
 
 #include <stdbool.h>
 #include <stdio.h>
 
 #include <inttypes.h>
 
+#include "rng.h"
+#include "units.h"
+
+/* A color set is a bitset: color i is in the set if bit i is set. With one
+   word it is a plain integer; wider sets are arrays of words, word 0 holding
+   colors 0 to 63. */
+#if COLORS_WORDS == 1
 typedef uint64_t colors_t;
+#else
+typedef struct
+{
+  uint64_t words[COLORS_WORDS];
+} colors_t;
+#endif
+
+/* The color set primitives below are defined here so that they can be
+   inlined in the heuristic loops. Bit counting and bit scanning use the
+   compiler builtins, which become single POPCNT/LZCNT/TZCNT instructions in
+   code compiled for a CPU that has them, and the portable code otherwise.
+   Hot functions are marked COLORS_DISPATCH: they are compiled once per
+   backend and the best one for the running CPU is picked at startup
+   (build with -DCOLORS_DISPATCH= to get the portable code only). */
+
+#if !defined(COLORS_DISPATCH) && defined(__x86_64__) && \
+    defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define COLORS_DISPATCH \
+  __attribute__((target_clones("arch=x86-64-v3", "popcnt", "default")))
+#endif
+#endif
+
+#ifndef COLORS_DISPATCH
+#define COLORS_DISPATCH
+#endif
+
+/* Returns the name of the backend used by COLORS_DISPATCH functions on the
+   running CPU */
+const char *colors_backend(void);
+
+/* Returns the number of bits set in a word */
+static inline size_t colors_word_count(const uint64_t word)
+{
+#if defined(__GNUC__)
+  return __builtin_popcountll(word);
+#else
+  uint64_t B5 = -1ULL >> 32;
+  uint64_t B4 = B5 ^ (B5 << 16);
+  uint64_t B3 = B4 ^ (B4 << 8);
+  uint64_t B2 = B3 ^ (B3 << 4);
+  uint64_t B1 = B2 ^ (B2 << 2);
+  uint64_t B0 = B1 ^ (B1 << 1);
+  uint64_t x = word;
+  x = ((x >> 1) & B0) + (x & B0);
+  x = ((x >> 2) & B1) + (x & B1);
+  x = ((x >> 4) + x) & B2;
+  x = ((x >> 8) + x) & B3;
+  x = ((x >> 16) + x) & B4;
+  x = ((x >> 32) + x) & B5;
+  return x;
+#endif
+}
+
+/* Returns the index of the lowest bit set in a non-zero word */
+static inline size_t colors_word_lowest(const uint64_t word)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(word);
+#else
+  return colors_word_count((word & -word) - 1);
+#endif
+}
+
+/* Returns the index of the highest bit set in a non-zero word */
+static inline size_t colors_word_highest(const uint64_t word)
+{
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(word);
+#else
+  size_t i = 0;
+  uint64_t a = word;
+  while (a != 0)
+  {
+    a = a >> 1;
+    i += 1;
+  }
+  return i - 1;
+#endif
+}
+
+#if COLORS_WORDS == 1
 
 /* Returns a full color set, containing all the colors of a grid size */
-colors_t colors_full(const size_t size);
+static inline colors_t colors_full(const size_t size)
+{
+  if (size == 0)
+  {
+    return 0;
+  }
+  if (size > MAX_COLORS - 1)
+  {
+    return -1ULL;
+  }
+  return -1ULL >> (MAX_COLORS - size);
+}
 
 /* Returns an empty color set */
-colors_t colors_empty(void);
+static inline colors_t colors_empty(void) { return 0; }
+
+/* Returns a boolean telling if a color set is empty */
+static inline bool colors_is_empty(const colors_t colors)
+{
+  return colors == 0;
+}
 
 /* Returns a choosen singleton color set */
-colors_t colors_set(const size_t color_id);
+static inline colors_t colors_set(const size_t color_id)
+{
+  if (color_id > MAX_COLORS - 1)
+  {
+    return 0;
+  }
+  return 1ULL << color_id;
+}
 
 /* Adds a color to a color set */
-colors_t colors_add(const colors_t colors, const size_t color_id);
+static inline colors_t colors_add(const colors_t colors, const size_t color_id)
+{
+  return colors_set(color_id) | colors;
+}
 
 /* Removes a color from a color set */
-colors_t colors_discard(const colors_t colors, const size_t color_id);
+static inline colors_t colors_discard(const colors_t colors,
+                                      const size_t color_id)
+{
+  return (~colors_set(color_id)) & colors;
+}
 
 /* Returns a boolean telling if a color is in a color set */
-bool colors_is_in(const colors_t colors, const size_t color_id);
+static inline bool colors_is_in(const colors_t colors, const size_t color_id)
+{
+  return (colors & colors_set(color_id)) != 0;
+}
 
 /* Returns the bitwise negation of a color set */
-colors_t colors_negate(const colors_t colors);
+static inline colors_t colors_negate(const colors_t colors) { return ~colors; }
 
 /* Returns a color set with all common colors two sets have */
-colors_t colors_and(const colors_t colors1, const colors_t colors2);
+static inline colors_t colors_and(const colors_t colors1,
+                                  const colors_t colors2)
+{
+  return colors1 & colors2;
+}
 
 /* Returns a color set sharing colors two sets have */
-colors_t colors_or(const colors_t colors1, const colors_t colors2);
+static inline colors_t colors_or(const colors_t colors1,
+                                 const colors_t colors2)
+{
+  return colors1 | colors2;
+}
 
 /* Returns a color set, which colors are those which only one set owns,
    regarding two given sets */
-colors_t colors_xor(const colors_t colors1, const colors_t colors2);
+static inline colors_t colors_xor(const colors_t colors1,
+                                  const colors_t colors2)
+{
+  return colors1 ^ colors2;
+}
 
 /* Returns a color set which colors are in a given set, but not in another */
-colors_t colors_subtract(const colors_t colors1, const colors_t colors2);
+static inline colors_t colors_subtract(const colors_t colors1,
+                                       const colors_t colors2)
+{
+  return colors1 & (~colors2);
+}
 
 /* Returns a boolean telling if two color sets are the same */
-bool colors_is_equal(const colors_t colors1, const colors_t colors2);
+static inline bool colors_is_equal(const colors_t colors1,
+                                   const colors_t colors2)
+{
+  return colors1 == colors2;
+}
 
 /* Returns a boolean telling if a color set is include in another */
-bool colors_is_subset(const colors_t colors1, const colors_t colors2);
+static inline bool colors_is_subset(const colors_t colors1,
+                                    const colors_t colors2)
+{
+  return ((~colors2) & colors1) == 0;
+}
 
 /* Returns a boolean telling if a color set is a singleton */
-bool colors_is_singleton(const colors_t colors);
+static inline bool colors_is_singleton(const colors_t colors)
+{
+  if (colors == 0)
+  {
+    return false;
+  }
+  return (colors & (colors - 1)) == 0;
+}
+
+/* Returns the number of colors in a colors set */
+static inline size_t colors_count(const colors_t colors)
+{
+  return colors_word_count(colors);
+}
+
+/* Returns the id of the bitwise rightmost color of a non-empty color set */
+static inline size_t colors_rightmost_id(const colors_t colors)
+{
+  return colors_word_lowest(colors);
+}
+
+/* Returns the id of the bitwise leftmost color of a non-empty color set */
+static inline size_t colors_leftmost_id(const colors_t colors)
+{
+  return colors_word_highest(colors);
+}
+
+/* Returns a singleton containing the bitwise rightmost color of a color set */
+static inline colors_t colors_rightmost(const colors_t colors)
+{
+  return colors & -colors;
+}
+
+/* Returns a singleton containing the bitwise leftmost color of a color set */
+static inline colors_t colors_leftmost(const colors_t colors)
+{
+  if (colors == 0)
+  {
+    return 0;
+  }
+  return colors_set(colors_leftmost_id(colors));
+}
+
+#else /* COLORS_WORDS > 1 */
+
+/* Returns a full color set, containing all the colors of a grid size */
+static inline colors_t colors_full(const size_t size)
+{
+  colors_t colors;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    if (size >= 64 * (w + 1))
+    {
+      colors.words[w] = -1ULL;
+    }
+    else if (size > 64 * w)
+    {
+      colors.words[w] = -1ULL >> (64 * (w + 1) - size);
+    }
+    else
+    {
+      colors.words[w] = 0;
+    }
+  }
+  return colors;
+}
+
+/* Returns an empty color set */
+static inline colors_t colors_empty(void)
+{
+  colors_t colors;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    colors.words[w] = 0;
+  }
+  return colors;
+}
+
+/* Returns a boolean telling if a color set is empty */
+static inline bool colors_is_empty(const colors_t colors)
+{
+  uint64_t any = 0;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    any |= colors.words[w];
+  }
+  return any == 0;
+}
+
+/* Returns a choosen singleton color set */
+static inline colors_t colors_set(const size_t color_id)
+{
+  colors_t colors = colors_empty();
+  if (color_id < MAX_COLORS)
+  {
+    colors.words[color_id / 64] = 1ULL << (color_id % 64);
+  }
+  return colors;
+}
+
+/* Returns a boolean telling if a color is in a color set */
+static inline bool colors_is_in(const colors_t colors, const size_t color_id)
+{
+  if (color_id > MAX_COLORS - 1)
+  {
+    return false;
+  }
+  return (colors.words[color_id / 64] >> (color_id % 64)) & 1;
+}
+
+/* Adds a color to a color set */
+static inline colors_t colors_add(const colors_t colors, const size_t color_id)
+{
+  colors_t result = colors;
+  if (color_id < MAX_COLORS)
+  {
+    result.words[color_id / 64] |= 1ULL << (color_id % 64);
+  }
+  return result;
+}
+
+/* Removes a color from a color set */
+static inline colors_t colors_discard(const colors_t colors,
+                                      const size_t color_id)
+{
+  colors_t result = colors;
+  if (color_id < MAX_COLORS)
+  {
+    result.words[color_id / 64] &= ~(1ULL << (color_id % 64));
+  }
+  return result;
+}
+
+/* Returns the bitwise negation of a color set */
+static inline colors_t colors_negate(const colors_t colors)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    result.words[w] = ~colors.words[w];
+  }
+  return result;
+}
+
+/* Returns a color set with all common colors two sets have */
+static inline colors_t colors_and(const colors_t colors1,
+                                  const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    result.words[w] = colors1.words[w] & colors2.words[w];
+  }
+  return result;
+}
+
+/* Returns a color set sharing colors two sets have */
+static inline colors_t colors_or(const colors_t colors1,
+                                 const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    result.words[w] = colors1.words[w] | colors2.words[w];
+  }
+  return result;
+}
+
+/* Returns a color set, which colors are those which only one set owns,
+   regarding two given sets */
+static inline colors_t colors_xor(const colors_t colors1,
+                                  const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    result.words[w] = colors1.words[w] ^ colors2.words[w];
+  }
+  return result;
+}
+
+/* Returns a color set which colors are in a given set, but not in another */
+static inline colors_t colors_subtract(const colors_t colors1,
+                                       const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    result.words[w] = colors1.words[w] & ~colors2.words[w];
+  }
+  return result;
+}
+
+/* Returns a boolean telling if two color sets are the same */
+static inline bool colors_is_equal(const colors_t colors1,
+                                   const colors_t colors2)
+{
+  uint64_t diff = 0;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    diff |= colors1.words[w] ^ colors2.words[w];
+  }
+  return diff == 0;
+}
+
+/* Returns a boolean telling if a color set is include in another */
+static inline bool colors_is_subset(const colors_t colors1,
+                                    const colors_t colors2)
+{
+  return colors_is_empty(colors_subtract(colors1, colors2));
+}
 
 /* Returns the number of colors in a colors set */
-size_t colors_count(const colors_t colors);
+static inline size_t colors_count(const colors_t colors)
+{
+  size_t count = 0;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    count += colors_word_count(colors.words[w]);
+  }
+  return count;
+}
+
+/* Returns a boolean telling if a color set is a singleton */
+static inline bool colors_is_singleton(const colors_t colors)
+{
+  return colors_count(colors) == 1;
+}
+
+/* Returns the id of the bitwise rightmost color of a non-empty color set */
+static inline size_t colors_rightmost_id(const colors_t colors)
+{
+  size_t w = 0;
+  while (colors.words[w] == 0)
+  {
+    w++;
+  }
+  return 64 * w + colors_word_lowest(colors.words[w]);
+}
+
+/* Returns the id of the bitwise leftmost color of a non-empty color set */
+static inline size_t colors_leftmost_id(const colors_t colors)
+{
+  size_t w = COLORS_WORDS - 1;
+  while (colors.words[w] == 0)
+  {
+    w--;
+  }
+  return 64 * w + colors_word_highest(colors.words[w]);
+}
 
 /* Returns a singleton containing the bitwise rightmost color of a color set */
-colors_t colors_rightmost(const colors_t colors);
+static inline colors_t colors_rightmost(const colors_t colors)
+{
+  if (colors_is_empty(colors))
+  {
+    return colors;
+  }
+  return colors_set(colors_rightmost_id(colors));
+}
 
 /* Returns a singleton containing the bitwise leftmost color of a color set */
-colors_t colors_leftmost(const colors_t colors);
+static inline colors_t colors_leftmost(const colors_t colors)
+{
+  if (colors_is_empty(colors))
+  {
+    return colors;
+  }
+  return colors_set(colors_leftmost_id(colors));
+}
+
+#endif /* COLORS_WORDS */
 
-/* Returns a singleton with a random color choosen from colors */
-colors_t colors_random(const colors_t colors);
+/* Returns a singleton containing the k-th color (counting from 0, from the
+   bitwise rightmost one) of a color set having more than k colors */
+colors_t colors_select(const colors_t colors, const size_t k);
+
+/* Returns a singleton with a random color choosen from colors, drawn from
+   the generator 'rng' */
+colors_t colors_random(const colors_t colors, rng_t *rng);
 
 /* Returns a boolean telling if a subgrid follows some consistency rules,
-   regarding some sudoku rules */
-bool subgrid_consistency(colors_t *subgrid[], const size_t size);
+   regarding some sudoku rules. The subgrid is made of the cells of 'cells'
+   whose indexes are listed in 'unit' */
+bool subgrid_consistency(colors_t cells[], const cell_index_t unit[],
+                         const size_t size);
+
+/* Removes from the cells of a subgrid the colors which cannot be part of
+   any assignment giving all colors to different cells (all-different
+   filtering by maximum matching and strongly connected components). A cell
+   is emptied if there is no such assignment. Returns true if a cell has
+   changed (same arguments as above). */
+bool subgrid_alldiff(colors_t cells[], const cell_index_t unit[],
+                     const size_t size);
+
+/* Removes the colors of the singletons of a subgrid from its other cells.
+   Returns true if a cell has changed (same arguments as above). */
+bool subgrid_crosshatching(colors_t cells[], const cell_index_t unit[],
+                           const size_t size);
+
+/* Sets a cell to a color which has no other place in the subgrid. The
+   colors of the singletons must have been removed from the other cells (see
+   subgrid_crosshatching()). Returns true if a cell has changed. */
+bool subgrid_hidden_singles(colors_t cells[], const cell_index_t unit[],
+                            const size_t size);
+
+/* Removes the colors of k cells having the same k colors from the other
+   cells of the subgrid. Returns true if a cell has changed. */
+bool subgrid_naked_subsets(colors_t cells[], const cell_index_t unit[],
+                           const size_t size);
+
+/* Keeps only the k colors of k cells (k = 2 or 3) when these colors have no
+   other place in the subgrid. Returns true if a cell has changed. */
+bool subgrid_hidden_subsets(colors_t cells[], const cell_index_t unit[],
+                            const size_t size);
+
+/* Applies the rules above on a subgrid, stopping at the first one which
+   changes a cell (same arguments as above) */
+bool subgrid_heuristics(colors_t cells[], const cell_index_t unit[],
+                        const size_t size);
 
-/* Applies several heuristics on a subgrid */
-bool subgrid_heuristics(colors_t *subgrid[], size_t size);
\ No newline at end of file
+#endif /* COLORS_H */
@@ -0,0 +1,20 @@
+#ifndef DLX_H
+#define DLX_H
+
+#include <stdio.h>
+
+#include "grid.h"
+
+/* Dancing Links (Knuth's Algorithm X) engine: a grid of size N is seen as an
+   exact cover problem of 4 * N^2 constraints (each cell has a color, each
+   row, column and block has each color once), each candidate color of a cell
+   covering 4 of them. Searches like grid_solver() in mode_first, mode_all or
+   mode_unique, incrementing *solution_count for each solution found and
+   writing the last one in the grid. In mode_all, solutions are printed in
+   'output' as grid_solver() does. The links of a size are allocated the
+   first time it is solved and reused by the next grids of the same size
+   solved by the same thread (each thread has its own cache). */
+void dlx_search(grid_t *grid, const mode_t mode, search_t *search,
+                uint64_t *solution_count, FILE *output);
+
+#endif /* DLX_H */
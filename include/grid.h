@@ -1,19 +1,25 @@
 #ifndef GRID_H
 #define GRID_H
 
-#define MAX_GRID_SIZE 64
+#include "colors.h"
+
+/* Bound on grid sizes: accepted sizes are the squares up to MAX_GRID_SIZE
+   (64 by default, 169 when built with COLORS_WORDS=3) */
+#define MAX_GRID_SIZE MAX_COLORS
 #define EMPTY_CELL '_'
 #define DICE 4
 #define RATIO 4
 
-#include "colors.h"
-
 static const char color_table[] = "123456789"
                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                   "@"
                                   "abcdefghijklmnopqrstuvwxyz"
                                   "&*";
 
+/* Number of colors which have a character in color_table, bigger grids are
+   read and written with numbers */
+#define TABLE_COLORS (sizeof(color_table) - 1)
+
 typedef struct
 {
   size_t row;
@@ -24,9 +30,108 @@ typedef struct
 typedef enum
 {
   mode_first,
-  mode_all
+  mode_all,
+  mode_unique /* stops at the second solution */
 } mode_t;
 
+/* How grid_choice() breaks ties between the cells with the fewest
+   candidates */
+typedef enum
+{
+  choice_position, /* the first cell in reading order */
+  choice_first,    /* any of them, in constant time */
+  choice_degree    /* the one with the most unsolved peers */
+} choice_policy_t;
+
+/* Algorithm used to search for solutions */
+typedef enum
+{
+  engine_backtrack, /* heuristics and backtracking on the grid */
+  engine_dlx,       /* exact cover with dancing links (see dlx.h) */
+  engine_cdcl       /* conflict-driven search with learning (see cdcl.h) */
+} engine_t;
+
+/* Rules of grid_heuristics(), chained in a pipeline in any order. The
+   unit rules are applied on each unit after cross-hatching (which is always
+   applied first), until one of them changes the unit. The grid rules are
+   applied in turn when the unit rules stall, until one of them removes a
+   candidate. */
+typedef enum
+{
+  rule_hidden_singles, /* unit: a color with one place left */
+  rule_naked_subsets,  /* unit: k cells with the same k colors */
+  rule_hidden_subsets, /* unit: k colors with the same k places (k <= 3) */
+  rule_intersections,  /* grid: pointing pairs and box-line reduction */
+  rule_fish,           /* grid: X-Wing, Swordfish... (see fish_order) */
+  rule_alldiff,        /* grid: all-different filtering of each unit */
+  RULES_COUNT
+} rule_t;
+
+/* The work of the rules is counted apart for the depths 0, 1, 2-3, 4-7...
+   of the decision stack, the last band gathering the deeper ones */
+#define RULE_BANDS 8
+
+/* Schedule of the restarts of a random backtracking search: the search
+   starts again from the root, with other random choices, once it has met a
+   budget of dead ends, the budget growing from one run to the next */
+typedef enum
+{
+  restart_none,     /* a single run */
+  restart_luby,     /* base times 1, 1, 2, 1, 1, 2, 4, 1... (see luby()) */
+  restart_geometric /* base times 1, 1.5, 2.25... */
+} restart_policy_t;
+
+/* Work done by a heuristic rule during a search */
+typedef struct
+{
+  size_t calls;   /* passes of the rule over a unit or over the grid */
+  size_t removed; /* candidates removed from the cells */
+  double seconds; /* time spent in the rule */
+  size_t skipped; /* calls avoided in adaptive mode */
+} rule_stats_t;
+
+/* Options and statistics of a search */
+typedef struct
+{
+  engine_t engine;
+  bool random;      /* choose colors with grid_choice_random() */
+  rng_t *rng;       /* generator used for random choices */
+  choice_policy_t tie_break;
+  size_t max_depth; /* maximal depth of the decision stack, 0 for no limit */
+  size_t threads;   /* workers of the backtrack engine, 0 or 1 for none */
+  size_t portfolio; /* searches raced by the backtrack engine, 0 or 1 for
+                       none (see portfolio_search()) */
+  rule_t rules[RULES_COUNT]; /* pipeline of the heuristics, in order */
+  size_t rules_count;
+  bool rules_set;    /* false for the default pipeline (see
+                        grid_rules_default()) */
+  size_t fish_order; /* largest fish of rule_fish (2: X-Wing, 3: Swordfish,
+                        4: Jellyfish) */
+  double adaptive;   /* minimal candidates removed per microsecond for a
+                        rule to be kept at a depth band, 0 to keep them all */
+  restart_policy_t restart_policy; /* restarts of a random search in
+                                      mode_first */
+  size_t restart_base; /* dead ends before the first restart, 0 for
+                          RESTART_BASE */
+  bool count_only;         /* mode_all counts the solutions without printing
+                              them */
+  uint64_t max_solutions;  /* mode_all stops after this many solutions, 0 for
+                              no limit */
+
+  /* Filled by the search */
+  size_t nodes; /* number of search nodes (heuristics passes) */
+  size_t depth; /* deepest decision stack reached */
+  bool cut;     /* true if branches were given up because of max_depth */
+  size_t conflicts; /* conflicts analysed (cdcl engine) */
+  size_t restarts;  /* restarts (cdcl engine, random backtrack search) */
+  size_t level;     /* current depth of the decision stack */
+  size_t winner;    /* member of the portfolio which found the solution */
+  rule_stats_t rules_stats[RULES_COUNT][RULE_BANDS];
+  size_t fish_decided; /* heuristics passes ended solved or inconsistent
+                          after the fish removed candidates: as many choices
+                          spared */
+} search_t;
+
 /* Sudoku grid (forward declaration to hide the implementation) */
 typedef struct _grid_t grid_t;
 
@@ -39,6 +144,16 @@ void grid_free(grid_t *grid);
 /* Prints a grid in a file */
 void grid_print(const grid_t *grid, FILE *fd);
 
+/* Prints the solution 'number' of a search in a file: a header and the grid,
+   or the grid alone when it is printed on a single line or packed */
+void grid_print_solution(const grid_t *grid, const uint64_t number, FILE *fd);
+
+/* Handles the solution 'number' found by a search in mode_all: prints it in
+   'output' unless search->count_only. Returns true if the search must stop,
+   search->max_solutions being reached. */
+bool grid_solution_found(const grid_t *grid, const search_t *search,
+                         const uint64_t number, FILE *output);
+
 /* Returns a boolean telling if a character is accepted in a sized grid */
 bool grid_check_char(const grid_t *grid, const char c);
 
@@ -51,10 +166,25 @@ grid_t *grid_copy(const grid_t *grid);
 /* Copies a grid 'grid' in another grid 'copy' */
 void grid_copy2(const grid_t *grid, grid_t *copy);
 
+/* Starts recording in a trail (undo log) the previous color set of every
+   cell changed by the heuristics or by a choice. Returns false if memory is
+   missing */
+bool grid_trail_enable(grid_t *grid);
+
+/* Returns the current position in the trail of a grid */
+size_t grid_trail_mark(const grid_t *grid);
+
+/* Restores all the cells changed since a position of the trail */
+void grid_trail_undo(grid_t *grid, const size_t mark);
+
 /* Returns a character string containing all colors of grid cell
    (seen as a color set) */
 char *grid_get_cell(const grid_t *grid, const size_t row, const size_t column);
 
+/* Returns the color set of a grid cell */
+colors_t grid_get_colors(const grid_t *grid, const size_t row,
+                         const size_t column);
+
 /* Returns the size of a grid */
 size_t grid_get_size(const grid_t *grid);
 
@@ -62,6 +192,33 @@ size_t grid_get_size(const grid_t *grid);
 void grid_set_cell(grid_t *grid, const size_t row, const size_t column,
                    const char color);
 
+/* Sets a grid cell from a number: 1 to size for a singleton, 0 for an empty
+   cell (all colors possible) */
+void grid_set_cell_number(grid_t *grid, const size_t row, const size_t column,
+                          const size_t number);
+
+/* Chooses how a grid is printed: with numbers 1 to size separated by spaces,
+   or with the characters of color_table. Grids bigger than TABLE_COLORS are
+   always printed with numbers. */
+void grid_set_numeric(grid_t *grid, const bool numeric);
+
+/* Chooses whether a grid is printed on a single line, its cells in reading
+   order with the characters of color_table (the format of '--lines'). Grids
+   bigger than TABLE_COLORS are never printed on a single line. */
+void grid_set_line(grid_t *grid, const bool line);
+
+/* Chooses whether a grid is printed packed, for programs reading the
+   solutions of a search in mode_all (option '--packed'). grid_solver() then
+   writes for the grid:
+   - a header of 8 bytes: "SDKP", the version of the format (1), the size of
+     the grid, the number of bits b of a cell and a zero byte;
+   - for each solution, the byte 'S' followed by the cells in reading order,
+     the color of a cell (0 to size - 1) taking b bits, from the lowest bits
+     of the first byte on, the last byte being padded with zeros;
+   - the byte 'E' followed by the number of solutions on 8 bytes, lowest byte
+     first. */
+void grid_set_packed(grid_t *grid, const bool packed);
+
 /* Returns a boolean telling if a grid has only singletons */
 bool grid_is_solved(grid_t *grid);
 
@@ -72,7 +229,8 @@ bool grid_is_consistent(grid_t *grid);
 /* Applies a function to all subgrids of a grid, and returns true if the
    function returned true for each subgrid */
 bool subgrid_apply(grid_t *grid,
-                   bool (*func)(colors_t *subgrid[], const size_t size));
+                   bool (*func)(colors_t cells[], const cell_index_t unit[],
+                                const size_t size));
 
 typedef enum
 {
@@ -81,9 +239,22 @@ typedef enum
   grid_inconsistent
 } status_t;
 
-/* Applies subgrid_heuristics on each subgrid as many times as it becomes
-   useless, and return status of the modified grid */
-status_t grid_heuristics(grid_t *grid);
+/* Applies the heuristics pipeline of 'search' (the default one if 'search'
+   is NULL) as many times as it becomes useless, and return status of the
+   modified grid. The work of each rule is counted in the statistics of
+   'search'. */
+status_t grid_heuristics(grid_t *grid, search_t *search);
+
+/* Sets the pipeline of a search to the default one: hidden singles, naked
+   subsets, hidden subsets and intersections */
+void grid_rules_default(search_t *search);
+
+/* Appends a rule to the pipeline of a search if it is not already there
+   (the pipeline being set, see grid_rules_default()) */
+void grid_rules_add(search_t *search, const rule_t rule);
+
+/* Returns the name of a rule, as written in the '--heuristics' option */
+const char *grid_rule_name(const rule_t rule);
 
 /* Behaves like grid_print but prints in stdout all possible characters instead
    of _ (debug purpose)*/
@@ -106,34 +277,55 @@ void grid_choice_print(const choice_t choice, FILE *fd);
 choice_t grid_choice(grid_t *grid);
 
 /* Chooses the smallest set of colors in a whole grid, selects a random color
-   color and returns this choice */
-choice_t grid_choice_random(grid_t *grid);
+   color (drawn from 'rng') and returns this choice */
+choice_t grid_choice_random(grid_t *grid, rng_t *rng);
 
 /* Will solve a given grid, searching for at least one solution if mode is
    mode_first, all solutions possible if mode_all.
    Boolean pointed by 'error' will be set to true if 0 solution is found in
    mode_all
    Output file is used only in mode_all, to print all found solutions
-   if boolean 'random' is true, backtrack_first will call grid_choice_random
-   instead of grid_choice()                                                  */
+   (or only their number, see search->count_only)
+   'search' gives the search options and receives its statistics          */
 grid_t *grid_solver(grid_t *grid, const mode_t mode, bool *error, FILE *output,
-                    bool random);
+                    search_t *search);
+
+/* Default budget of dead ends before the first restart of a random
+   backtracking search */
+#define RESTART_BASE 64
+
+/* Returns the element 'index' (from 0) of the Luby sequence: 1 1 2 1 1 2 4
+   1 1 2 1 1 2 4 8... */
+size_t luby(size_t index);
+
+/* Worker of a parallel search (see parallel.h) */
+typedef struct worker worker_t;
+
+/* Backtracking search of grid_solver() with the backtrack engine, in the
+   calling thread. When 'worker' is not NULL, the grid is a task of a
+   parallel search: solutions and branches left to other workers are given
+   to 'worker', 'solution_count' and 'output' being unused. */
+void grid_search(grid_t *grid, const mode_t mode, search_t *search,
+                 uint64_t *solution_count, FILE *output, worker_t *worker);
 
-/* Uses backtrack method to search to a grid solution */
-void backtrack_first(grid_t *grid, bool *solution_found, bool random);
+/* Uses backtrack method to search to a grid solution (if 'rng' is not NULL,
+   calls grid_choice_random() with it instead of grid_choice()) */
+void backtrack_first(grid_t *grid, bool *solution_found, rng_t *rng);
 
 /* Uses backtrack method to search to""back" all solutions of a grid */
-void backtrack_all(grid_t *grid, int *solution_count, FILE *output);
+void backtrack_all(grid_t *grid, uint64_t *solution_count, FILE *output);
 
-/* Generates a grid of a choosen size and returns a pointer to it */
-grid_t *grid_generation(int size, bool unique);
+/* Generates a grid of a choosen size and returns a pointer to it, all random
+   draws coming from 'rng' */
+grid_t *grid_generation(int size, bool unique, rng_t *rng);
 
 /* Returns a boolean telling if a grid has a unique solution */
 bool solution_is_unique(grid_t *grid);
 
-/* It's a backtrack method applied on a grid that we know has a solution,
-   it will set *solution_count to 2 if grid has at least 2 solutions.
+/* It's a search applied on a grid that we know has a solution, with the
+   exact cover engine (dlx_search() in mode_unique), it will set
+   *solution_count to 2 if grid has at least 2 solutions.
    Used only in solution_is_unique()                                     */
-void backtrack_unique_solution(grid_t *grid, int *solution_count);
+void backtrack_unique_solution(grid_t *grid, uint64_t *solution_count);
 
 #endif /* GRID_H */
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Reader of a file in the line format (option '-l'): a regular file is
+   mapped in memory at once, the standard input or a pipe is read by large
+   blocks, and lines are cut in place, without stdio */
+typedef struct
+{
+  const char *file_name;
+  int fd;
+  char *data;      /* mapped file, or buffer of the bytes read so far */
+  size_t length;   /* bytes in 'data' */
+  size_t start;    /* beginning of the next line in 'data' */
+  size_t capacity; /* size of the buffer, 0 for a mapped file */
+  bool eof;        /* nothing left to read after 'data' */
+  bool error;
+} lines_t;
+
+
+/* Opens a file in the line format, '-' standing for the standard input.
+   Returns false (after a warning) if it cannot be opened. */
+bool lines_open(lines_t *lines, const char *file_name);
+
+/* Returns false at the end of the file, else points *line to the next line
+   (without its '\n') and sets its length. The line stays valid until the
+   next call. */
+bool lines_next(lines_t *lines, const char **line, size_t *length);
+
+/* Releases a file opened by lines_open() */
+void lines_close(lines_t *lines);
+
+#endif /* LINES_H */
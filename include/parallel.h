@@ -0,0 +1,97 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "grid.h"
+
+/* Cache line size: the two ends of a queue are kept apart, as they are
+   written by different threads */
+#define QUEUE_ALIGNMENT 64
+
+typedef struct queue_cell queue_cell_t;
+
+/* Bounded queue of pointers shared by any number of producer and consumer
+   threads, without lock: each cell of a ring has a sequence number telling
+   in which round it can be filled or emptied, producers and consumers
+   taking their cell with a compare-and-swap on their end of the ring */
+typedef struct
+{
+  queue_cell_t *cells;
+  size_t mask; /* capacity - 1, the capacity being a power of 2 */
+  _Alignas(QUEUE_ALIGNMENT) atomic_size_t head; /* next cell to fill */
+  _Alignas(QUEUE_ALIGNMENT) atomic_size_t tail; /* next cell to empty */
+} queue_t;
+
+/* Backtracking search spread over search->threads workers. A branch of the
+   search tree is a task, holding its own copy of the grid: each worker
+   explores its tasks like grid_search() does, and gives the discard branch
+   of a choice to its deque when some workers are idle, the idle workers
+   stealing the oldest tasks of the others. Searches like grid_solver() in
+   mode_first, mode_all or mode_unique: the search stops as soon as enough
+   solutions are found. In mode_all the solutions are printed in 'output' in
+   the order of a sequential search, as soon as no task left can find a
+   solution before them: a solution found in a later branch is kept until
+   the earlier branches are done (when search->max_solutions stops the
+   search, the solutions found may not be the first ones of a sequential
+   search). */
+void parallel_search(grid_t *grid, const mode_t mode, search_t *search,
+                     uint64_t *solution_count, FILE *output);
+
+/* Races search->portfolio searches of a grid in mode_first, one thread
+   each, the first solution found stopping the others: the first member
+   searches with the options of 'search', and the others with random
+   choices (streams split from search->rng), another tie-break policy, and
+   possibly the all-different filtering or the fish. The member which found
+   the solution is written in search->winner. */
+void portfolio_search(grid_t *grid, search_t *search, uint64_t *solution_count);
+
+/* Sets the options of a member of a portfolio from the options of the
+   search */
+void portfolio_config(search_t *config, const size_t member);
+
+/* Initializes an empty queue holding at least 'capacity' items. Returns
+   false if memory is missing. */
+bool queue_init(queue_t *queue, const size_t capacity);
+
+/* Frees the cells of a queue */
+void queue_destroy(queue_t *queue);
+
+/* Appends an item to a queue. Returns false if the queue is full. */
+bool queue_try_push(queue_t *queue, void *item);
+
+/* Removes the oldest item of a queue in *item. Returns false if the queue
+   is empty. */
+bool queue_try_pop(queue_t *queue, void **item);
+
+/* Same as queue_try_push(), waiting while the queue is full */
+void queue_push(queue_t *queue, void *item);
+
+/* Same as queue_try_pop(), waiting while the queue is empty: returns the
+   item */
+void *queue_pop(queue_t *queue);
+
+/* The functions below are called by grid_search() when it runs a task */
+
+/* Returns true if the search is over, the task being given up */
+bool parallel_stopped(const worker_t *worker);
+
+/* Returns the number of choices made above the branch of the task */
+size_t parallel_depth(const worker_t *worker);
+
+/* Returns true if some workers wait for a task */
+bool parallel_hungry(const worker_t *worker);
+
+/* Gives a branch of the task to other workers: 'branch' is a grid owned by
+   the new task, whose branch is at 'depth' choices from the root, 'path'
+   being the branches taken from the task to it */
+void parallel_donate(worker_t *worker, grid_t *branch, const size_t depth,
+                     const unsigned char path[], const size_t length);
+
+/* Records a solution found at 'path' from the task. Returns true if the
+   worker must stop its search. */
+bool parallel_solution(worker_t *worker, const grid_t *grid,
+                       const unsigned char path[], const size_t length);
+
+#endif /* PARALLEL_H */
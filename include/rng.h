@@ -0,0 +1,32 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* State of a xoshiro256** pseudo-random generator. Each user (a search, a
+   thread...) owns its state, so that runs are reproducible from a seed and
+   so that no state is shared between threads. */
+typedef struct
+{
+  uint64_t s[4];
+} rng_t;
+
+/* Initializes a generator from a seed */
+void rng_seed(rng_t *rng, const uint64_t seed);
+
+/* Returns a seed made from the time and the process id */
+uint64_t rng_default_seed(void);
+
+/* Initializes 'stream' as a new stream of 'rng': 'stream' takes the current
+   state and 'rng' jumps 2^128 steps ahead, so that streams split from the
+   same generator never overlap (one per worker thread for instance) */
+void rng_split(rng_t *rng, rng_t *stream);
+
+/* Returns 64 random bits */
+uint64_t rng_next(rng_t *rng);
+
+/* Returns a random number in [0, bound), bound being non-zero */
+size_t rng_below(rng_t *rng, const size_t bound);
+
+#endif /* RNG_H */
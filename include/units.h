@@ -0,0 +1,50 @@
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Index of a cell in a grid stored row by row */
+typedef uint16_t cell_index_t;
+
+/* Precomputed index tables of a grid size. A unit is a row, a column or a
+   block: units 0 to size - 1 are the rows, size to 2 * size - 1 the columns
+   and 2 * size to 3 * size - 1 the blocks. The peers of a cell are all the
+   other cells sharing a unit with it. */
+typedef struct
+{
+  size_t size;
+  size_t sqr;            /* square root of size (width of a block) */
+  size_t peers_count;    /* number of peers of each cell */
+  cell_index_t *units;   /* size cells for each of the 3 * size units */
+  cell_index_t *cell_units; /* row, column and block units of each cell */
+  cell_index_t *peers;   /* peers_count peers for each cell */
+} units_t;
+
+/* Returns the tables of a grid size, built the first time they are asked for
+   and kept until the end of the program, or NULL if size is not a square or
+   if memory is missing */
+const units_t *units_get(const size_t size);
+
+/* Returns the cells of a unit */
+static inline const cell_index_t *units_unit(const units_t *units,
+                                             const size_t unit)
+{
+  return &units->units[unit * units->size];
+}
+
+/* Returns the 3 units (row, column, block) of a cell */
+static inline const cell_index_t *units_of_cell(const units_t *units,
+                                                const size_t cell)
+{
+  return &units->cell_units[3 * cell];
+}
+
+/* Returns the peers of a cell */
+static inline const cell_index_t *units_peers(const units_t *units,
+                                              const size_t cell)
+{
+  return &units->peers[units->peers_count * cell];
+}
+
+#endif /* UNITS_H */
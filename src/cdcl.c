@@ -0,0 +1,961 @@
+#include "cdcl.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <err.h>
+
+#include "colors.h"
+#include "units.h"
+
+/* Variable 'cell * size + color' is true if the cell has the color. The
+   literal 2 * var tells that it is true, 2 * var + 1 that it is false. */
+#define VALUE_UNDEF 0
+#define VALUE_TRUE 1
+#define VALUE_FALSE 2
+
+#define NO_COLOR UINT32_MAX
+
+/* Conflicts before the first restart, multiplied by the Luby sequence */
+#define CDCL_RESTART_BASE 100
+
+#define ACTIVITY_DECAY 0.95
+
+/* Why a variable has been assigned (or why a conflict happened) */
+typedef enum
+{
+  reason_none,   /* decision, or grid given at level 0 */
+  reason_peer,   /* a peer (or the cell itself) has the color: 'data' var */
+  reason_cell,   /* the other colors of the cell are gone */
+  reason_unit,   /* the other cells of unit 'data' cannot have the color */
+  reason_clause, /* learnt clause at offset 'data' of the arena */
+  reason_pair    /* conflict only: vars 'data' and 'data2' are both true */
+} reason_t;
+
+/* Clauses watching a literal */
+typedef struct
+{
+  uint32_t *clauses;
+  uint32_t count;
+  uint32_t capacity;
+} watches_t;
+
+/* Growable array of variables or literals */
+typedef struct
+{
+  uint32_t *items;
+  size_t count;
+  size_t capacity;
+} vector_t;
+
+typedef struct
+{
+  size_t size;
+  const units_t *units;
+  size_t vars; /* size^3 */
+
+  unsigned char *value;
+  unsigned char *reason_kind;
+  uint32_t *reason;
+  uint32_t *level;
+  double *activity;
+  double activity_inc;
+  unsigned char *seen;
+
+  uint32_t *trail; /* assigned variables, in order */
+  size_t trail_top;
+  size_t propagated;      /* variables of the trail already propagated */
+  size_t *level_start;    /* trail position of the decision of each level */
+  size_t decision_level;
+
+  uint32_t *cell_color;  /* true color of each cell, or NO_COLOR */
+  uint32_t *cell_count;  /* colors which are not false in each cell */
+  uint32_t *unit_count;  /* cells of unit u where color c is not false,
+                            at u * size + c */
+  size_t cells_assigned; /* cells with a true color */
+
+  /* Learnt clauses: size, then lbd (0 for clauses which must be kept), then
+     literals. The first two literals are the watched ones. */
+  uint32_t *arena;
+  size_t arena_top;
+  size_t arena_capacity;
+  size_t learnts;
+  size_t max_learnts;
+  watches_t *watches; /* indexed by literal */
+
+  reason_t conflict_kind;
+  uint32_t conflict_data;
+  uint32_t conflict_data2;
+
+  vector_t antecedents; /* explanation of an assignment or a conflict */
+  vector_t learnt;
+  uint32_t *level_stamp; /* used to count the levels of a clause */
+  uint32_t stamp;
+} cdcl_t;
+
+static void vector_push(vector_t *vector, const uint32_t item)
+{
+  if (vector->count == vector->capacity)
+  {
+    size_t capacity = vector->capacity == 0 ? 64 : 2 * vector->capacity;
+    uint32_t *items = realloc(vector->items, capacity * sizeof(uint32_t));
+    if (items == NULL)
+    {
+      err(EXIT_FAILURE,
+          "Error: Impossible to grow a vector of the cdcl engine");
+    }
+    vector->items = items;
+    vector->capacity = capacity;
+  }
+  vector->items[vector->count++] = item;
+}
+
+static void watches_push(watches_t *watches, const uint32_t clause)
+{
+  if (watches->count == watches->capacity)
+  {
+    uint32_t capacity = watches->capacity == 0 ? 4 : 2 * watches->capacity;
+    uint32_t *clauses = realloc(watches->clauses, capacity * sizeof(uint32_t));
+    if (clauses == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the watches of a clause");
+    }
+    watches->clauses = clauses;
+    watches->capacity = capacity;
+  }
+  watches->clauses[watches->count++] = clause;
+}
+
+/* Returns VALUE_TRUE, VALUE_FALSE or VALUE_UNDEF for a literal */
+static inline unsigned char cdcl_literal_value(const cdcl_t *s,
+                                               const uint32_t literal)
+{
+  unsigned char value = s->value[literal >> 1];
+  if (value == VALUE_UNDEF || (literal & 1) == 0)
+  {
+    return value;
+  }
+  return (value == VALUE_TRUE) ? VALUE_FALSE : VALUE_TRUE;
+}
+
+/* Returns the literal of a variable which is false with its current value */
+static inline uint32_t cdcl_false_literal(const cdcl_t *s, const uint32_t var)
+{
+  return 2 * var + (s->value[var] == VALUE_TRUE);
+}
+
+static void cdcl_free(cdcl_t *s)
+{
+  /* Also frees a partially allocated engine, 'watches' may be NULL */
+  for (size_t literal = 0; s->watches != NULL && literal < 2 * s->vars;
+       literal++)
+  {
+    free(s->watches[literal].clauses);
+  }
+  free(s->value);
+  free(s->reason_kind);
+  free(s->reason);
+  free(s->level);
+  free(s->activity);
+  free(s->seen);
+  free(s->trail);
+  free(s->level_start);
+  free(s->cell_color);
+  free(s->cell_count);
+  free(s->unit_count);
+  free(s->arena);
+  free(s->watches);
+  free(s->antecedents.items);
+  free(s->learnt.items);
+  free(s->level_stamp);
+  free(s);
+}
+
+static cdcl_t *cdcl_alloc(const size_t size)
+{
+  cdcl_t *s = calloc(1, sizeof(cdcl_t));
+  if (s == NULL)
+  {
+    return NULL;
+  }
+
+  size_t cells_count = size * size;
+  s->size = size;
+  s->units = units_get(size);
+  s->vars = cells_count * size;
+  s->value = calloc(s->vars, 1);
+  s->reason_kind = calloc(s->vars, 1);
+  s->reason = malloc(s->vars * sizeof(uint32_t));
+  s->level = malloc(s->vars * sizeof(uint32_t));
+  s->activity = calloc(s->vars, sizeof(double));
+  s->seen = calloc(s->vars, 1);
+  s->trail = malloc(s->vars * sizeof(uint32_t));
+  s->level_start = malloc((cells_count + 1) * sizeof(size_t));
+  s->cell_color = malloc(cells_count * sizeof(uint32_t));
+  s->cell_count = malloc(cells_count * sizeof(uint32_t));
+  s->unit_count = malloc(3 * cells_count * sizeof(uint32_t));
+  s->watches = calloc(2 * s->vars, sizeof(watches_t));
+  s->level_stamp = calloc(cells_count + 1, sizeof(uint32_t));
+
+  if (s->units == NULL || s->value == NULL || s->reason_kind == NULL ||
+      s->reason == NULL || s->level == NULL || s->activity == NULL ||
+      s->seen == NULL || s->trail == NULL || s->level_start == NULL ||
+      s->cell_color == NULL || s->cell_count == NULL ||
+      s->unit_count == NULL || s->watches == NULL || s->level_stamp == NULL)
+  {
+    cdcl_free(s);
+    return NULL;
+  }
+
+  for (size_t cell = 0; cell < cells_count; cell++)
+  {
+    s->cell_color[cell] = NO_COLOR;
+    s->cell_count[cell] = size;
+  }
+  for (size_t i = 0; i < 3 * cells_count; i++)
+  {
+    s->unit_count[i] = size;
+  }
+
+  s->activity_inc = 1;
+  s->max_learnts = cells_count;
+  return s;
+}
+
+/* Makes a literal true at the current level */
+static void cdcl_assign(cdcl_t *s, const uint32_t literal,
+                        const reason_t kind, const uint32_t reason)
+{
+  uint32_t var = literal >> 1;
+  size_t cell = var / s->size;
+  size_t color = var % s->size;
+
+  s->reason_kind[var] = kind;
+  s->reason[var] = reason;
+  s->level[var] = s->decision_level;
+  s->trail[s->trail_top++] = var;
+
+  if ((literal & 1) == 0)
+  {
+    s->value[var] = VALUE_TRUE;
+    s->cell_color[cell] = color;
+    s->cells_assigned++;
+  }
+  else
+  {
+    s->value[var] = VALUE_FALSE;
+    s->cell_count[cell]--;
+    const cell_index_t *cell_units = units_of_cell(s->units, cell);
+    for (size_t i = 0; i < 3; i++)
+    {
+      s->unit_count[cell_units[i] * s->size + color]--;
+    }
+  }
+}
+
+/* Unassigns all the variables above a level */
+static void cdcl_backjump(cdcl_t *s, const size_t level)
+{
+  if (s->decision_level <= level)
+  {
+    return;
+  }
+
+  size_t start = s->level_start[level + 1];
+  while (s->trail_top > start)
+  {
+    uint32_t var = s->trail[--s->trail_top];
+    size_t cell = var / s->size;
+    size_t color = var % s->size;
+
+    if (s->value[var] == VALUE_TRUE)
+    {
+      s->cell_color[cell] = NO_COLOR;
+      s->cells_assigned--;
+    }
+    else
+    {
+      s->cell_count[cell]++;
+      const cell_index_t *cell_units = units_of_cell(s->units, cell);
+      for (size_t i = 0; i < 3; i++)
+      {
+        s->unit_count[cell_units[i] * s->size + color]++;
+      }
+    }
+    s->value[var] = VALUE_UNDEF;
+  }
+
+  s->propagated = s->trail_top;
+  s->decision_level = level;
+}
+
+static bool cdcl_conflict(cdcl_t *s, const reason_t kind, const uint32_t data,
+                          const uint32_t data2)
+{
+  s->conflict_kind = kind;
+  s->conflict_data = data;
+  s->conflict_data2 = data2;
+  return false;
+}
+
+/* Makes a variable false because of the true variable 'source', returns
+   false on a conflict */
+static inline bool cdcl_remove(cdcl_t *s, const uint32_t var,
+                               const uint32_t source)
+{
+  if (s->value[var] == VALUE_UNDEF)
+  {
+    cdcl_assign(s, 2 * var + 1, reason_peer, source);
+  }
+  else if (s->value[var] == VALUE_TRUE)
+  {
+    return cdcl_conflict(s, reason_pair, source, var);
+  }
+  return true;
+}
+
+/* Visits the clauses watching a literal which has become false, returns
+   false on a conflict */
+static bool cdcl_propagate_clauses(cdcl_t *s, const uint32_t literal)
+{
+  watches_t *watches = &s->watches[literal];
+  uint32_t i = 0;
+  uint32_t j = 0;
+
+  while (i < watches->count)
+  {
+    uint32_t clause = watches->clauses[i++];
+    uint32_t clause_size = s->arena[clause];
+    uint32_t *literals = &s->arena[clause + 2];
+
+    if (literals[0] == literal)
+    {
+      literals[0] = literals[1];
+      literals[1] = literal;
+    }
+
+    if (cdcl_literal_value(s, literals[0]) == VALUE_TRUE)
+    {
+      watches->clauses[j++] = clause;
+      continue;
+    }
+
+    bool moved = false;
+    for (uint32_t k = 2; k < clause_size; k++)
+    {
+      if (cdcl_literal_value(s, literals[k]) != VALUE_FALSE)
+      {
+        literals[1] = literals[k];
+        literals[k] = literal;
+        watches_push(&s->watches[literals[1]], clause);
+        moved = true;
+        break;
+      }
+    }
+    if (moved)
+    {
+      continue;
+    }
+
+    watches->clauses[j++] = clause;
+    if (cdcl_literal_value(s, literals[0]) == VALUE_FALSE)
+    {
+      while (i < watches->count)
+      {
+        watches->clauses[j++] = watches->clauses[i++];
+      }
+      watches->count = j;
+      return cdcl_conflict(s, reason_clause, clause, 0);
+    }
+    cdcl_assign(s, literals[0], reason_clause, clause);
+  }
+
+  watches->count = j;
+  return true;
+}
+
+/* Propagates the rules of sudoku and the learnt clauses from the variables
+   of the trail which have not been propagated yet. Returns false on a
+   conflict. */
+static bool cdcl_propagate(cdcl_t *s)
+{
+  size_t size = s->size;
+
+  while (s->propagated < s->trail_top)
+  {
+    uint32_t var = s->trail[s->propagated++];
+    size_t cell = var / size;
+    size_t color = var % size;
+
+    if (s->value[var] == VALUE_TRUE)
+    {
+      for (size_t other = 0; other < size; other++)
+      {
+        if (other != color && !cdcl_remove(s, cell * size + other, var))
+        {
+          return false;
+        }
+      }
+
+      const cell_index_t *peers = units_peers(s->units, cell);
+      for (size_t i = 0; i < s->units->peers_count; i++)
+      {
+        if (!cdcl_remove(s, peers[i] * size + color, var))
+        {
+          return false;
+        }
+      }
+
+      if (!cdcl_propagate_clauses(s, 2 * var + 1))
+      {
+        return false;
+      }
+      continue;
+    }
+
+    /* The color has been removed from the cell: the cell and its units may
+       have only one place left */
+    if (s->cell_count[cell] == 0)
+    {
+      return cdcl_conflict(s, reason_cell, cell, 0);
+    }
+    if (s->cell_count[cell] == 1 && s->cell_color[cell] == NO_COLOR)
+    {
+      for (size_t other = 0; other < size; other++)
+      {
+        if (s->value[cell * size + other] != VALUE_FALSE)
+        {
+          cdcl_assign(s, 2 * (cell * size + other), reason_cell, 0);
+          break;
+        }
+      }
+    }
+
+    const cell_index_t *cell_units = units_of_cell(s->units, cell);
+    for (size_t i = 0; i < 3; i++)
+    {
+      size_t count = s->unit_count[cell_units[i] * size + color];
+      if (count == 0)
+      {
+        return cdcl_conflict(s, reason_unit, cell_units[i], color);
+      }
+      if (count == 1)
+      {
+        const cell_index_t *unit = units_unit(s->units, cell_units[i]);
+        for (size_t k = 0; k < size; k++)
+        {
+          uint32_t other = unit[k] * size + color;
+          if (s->value[other] == VALUE_UNDEF)
+          {
+            cdcl_assign(s, 2 * other, reason_unit, cell_units[i]);
+            break;
+          }
+          if (s->value[other] == VALUE_TRUE)
+          {
+            break;
+          }
+        }
+      }
+    }
+
+    if (!cdcl_propagate_clauses(s, 2 * var))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Fills s->antecedents with the variables whose values implied 'var' (or
+   the conflict if var is UINT32_MAX). Explanations are built only here, when
+   a conflict is analysed. */
+static void cdcl_explain(cdcl_t *s, const uint32_t var, const reason_t kind,
+                         const uint32_t data, const uint32_t data2)
+{
+  size_t size = s->size;
+  s->antecedents.count = 0;
+
+  switch (kind)
+  {
+    case reason_peer:
+      vector_push(&s->antecedents, data);
+      break;
+
+    case reason_pair:
+      vector_push(&s->antecedents, data);
+      vector_push(&s->antecedents, data2);
+      break;
+
+    case reason_cell:
+    {
+      size_t cell = (var == UINT32_MAX) ? data : var / size;
+      for (size_t color = 0; color < size; color++)
+      {
+        if (cell * size + color != var)
+        {
+          vector_push(&s->antecedents, cell * size + color);
+        }
+      }
+      break;
+    }
+
+    case reason_unit:
+    {
+      size_t color = (var == UINT32_MAX) ? data2 : var % size;
+      const cell_index_t *unit = units_unit(s->units, data);
+      for (size_t k = 0; k < size; k++)
+      {
+        if (unit[k] * size + color != var)
+        {
+          vector_push(&s->antecedents, unit[k] * size + color);
+        }
+      }
+      break;
+    }
+
+    case reason_clause:
+    {
+      uint32_t *literals = &s->arena[data + 2];
+      for (uint32_t k = 0; k < s->arena[data]; k++)
+      {
+        if ((literals[k] >> 1) != var)
+        {
+          vector_push(&s->antecedents, literals[k] >> 1);
+        }
+      }
+      break;
+    }
+
+    case reason_none:
+      break;
+  }
+}
+
+static void cdcl_bump(cdcl_t *s, const uint32_t var)
+{
+  s->activity[var] += s->activity_inc;
+  if (s->activity[var] > 1e100)
+  {
+    for (size_t i = 0; i < s->vars; i++)
+    {
+      s->activity[i] *= 1e-100;
+    }
+    s->activity_inc *= 1e-100;
+  }
+}
+
+/* Returns the number of distinct levels of the literals of s->learnt */
+static uint32_t cdcl_lbd(cdcl_t *s)
+{
+  s->stamp++;
+  uint32_t lbd = 0;
+  for (size_t i = 0; i < s->learnt.count; i++)
+  {
+    uint32_t level = s->level[s->learnt.items[i] >> 1];
+    if (s->level_stamp[level] != s->stamp)
+    {
+      s->level_stamp[level] = s->stamp;
+      lbd++;
+    }
+  }
+  return lbd;
+}
+
+/* Returns true if the values which implied a variable of the learnt clause
+   are all in the clause already (or given at level 0): the clause stays
+   implied without it */
+static bool cdcl_redundant(cdcl_t *s, const uint32_t var)
+{
+  if (s->reason_kind[var] == reason_none)
+  {
+    return false;
+  }
+
+  cdcl_explain(s, var, s->reason_kind[var], s->reason[var], 0);
+  for (size_t i = 0; i < s->antecedents.count; i++)
+  {
+    uint32_t antecedent = s->antecedents.items[i];
+    if (!s->seen[antecedent] && s->level[antecedent] != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Learns in s->learnt the clause of the first unique implication point of
+   the current conflict: its first literal is the only one of the current
+   level, its second one has the highest level of the others. Returns the
+   level to jump back to. */
+static size_t cdcl_analyze(cdcl_t *s)
+{
+  size_t path = 0;
+  size_t index = s->trail_top;
+  uint32_t var = UINT32_MAX;
+
+  s->learnt.count = 0;
+  vector_push(&s->learnt, 0); /* room for the asserting literal */
+  cdcl_explain(s, var, s->conflict_kind, s->conflict_data,
+               s->conflict_data2);
+
+  while (true)
+  {
+    for (size_t i = 0; i < s->antecedents.count; i++)
+    {
+      uint32_t antecedent = s->antecedents.items[i];
+      if (s->seen[antecedent] || s->level[antecedent] == 0)
+      {
+        continue;
+      }
+
+      s->seen[antecedent] = 1;
+      cdcl_bump(s, antecedent);
+      if (s->level[antecedent] == s->decision_level)
+      {
+        path++;
+      }
+      else
+      {
+        vector_push(&s->learnt, cdcl_false_literal(s, antecedent));
+      }
+    }
+
+    do
+    {
+      var = s->trail[--index];
+    } while (!s->seen[var]);
+
+    s->seen[var] = 0;
+    path--;
+    if (path == 0)
+    {
+      break;
+    }
+    cdcl_explain(s, var, s->reason_kind[var], s->reason[var], 0);
+  }
+
+  s->learnt.items[0] = cdcl_false_literal(s, var);
+
+  /* Redundant literals are moved after the kept ones, their variables are
+     still seen until the end */
+  size_t learnt_count = s->learnt.count;
+  size_t kept = 1;
+  for (size_t i = 1; i < learnt_count; i++)
+  {
+    if (!cdcl_redundant(s, s->learnt.items[i] >> 1))
+    {
+      uint32_t literal = s->learnt.items[i];
+      s->learnt.items[i] = s->learnt.items[kept];
+      s->learnt.items[kept++] = literal;
+    }
+  }
+  s->learnt.count = kept;
+
+  for (size_t i = kept; i < learnt_count; i++)
+  {
+    s->seen[s->learnt.items[i] >> 1] = 0;
+  }
+
+  size_t level = 0;
+  size_t highest = 1;
+  for (size_t i = 1; i < s->learnt.count; i++)
+  {
+    uint32_t other = s->learnt.items[i] >> 1;
+    s->seen[other] = 0;
+    if (s->level[other] > level)
+    {
+      level = s->level[other];
+      highest = i;
+    }
+  }
+
+  if (s->learnt.count > 1)
+  {
+    uint32_t literal = s->learnt.items[highest];
+    s->learnt.items[highest] = s->learnt.items[1];
+    s->learnt.items[1] = literal;
+  }
+
+  s->activity_inc /= ACTIVITY_DECAY;
+  return level;
+}
+
+/* Stores s->learnt in the arena and watches its first two literals, returns
+   its offset */
+static uint32_t cdcl_add_clause(cdcl_t *s, const uint32_t lbd)
+{
+  size_t needed = s->arena_top + 2 + s->learnt.count;
+  if (needed > s->arena_capacity)
+  {
+    size_t capacity = s->arena_capacity == 0 ? 4096 : 2 * s->arena_capacity;
+    while (capacity < needed)
+    {
+      capacity *= 2;
+    }
+    uint32_t *arena = realloc(s->arena, capacity * sizeof(uint32_t));
+    if (arena == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the learnt clauses");
+    }
+    s->arena = arena;
+    s->arena_capacity = capacity;
+  }
+
+  uint32_t clause = s->arena_top;
+  s->arena[clause] = s->learnt.count;
+  s->arena[clause + 1] = lbd;
+  memcpy(&s->arena[clause + 2], s->learnt.items,
+         s->learnt.count * sizeof(uint32_t));
+  s->arena_top = needed;
+
+  watches_push(&s->watches[s->learnt.items[0]], clause);
+  watches_push(&s->watches[s->learnt.items[1]], clause);
+  s->learnts++;
+  return clause;
+}
+
+/* Jumps back and asserts the first literal of s->learnt, keeping the clause
+   if it has several literals ('lbd' 0 for a clause never to be deleted) */
+static void cdcl_learn(cdcl_t *s, const size_t level, const uint32_t lbd)
+{
+  cdcl_backjump(s, level);
+
+  if (s->learnt.count == 1)
+  {
+    cdcl_assign(s, s->learnt.items[0], reason_none, 0);
+  }
+  else
+  {
+    uint32_t clause = cdcl_add_clause(s, lbd);
+    cdcl_assign(s, s->learnt.items[0], reason_clause, clause);
+  }
+}
+
+/* Forbids the current decisions, after a solution or when the branch is
+   too deep. Returns false if there is no decision left to change. */
+static bool cdcl_block(cdcl_t *s)
+{
+  if (s->decision_level == 0)
+  {
+    return false;
+  }
+
+  s->learnt.count = 0;
+  for (size_t level = s->decision_level; level > 0; level--)
+  {
+    vector_push(&s->learnt, s->trail[s->level_start[level]] * 2 + 1);
+  }
+  cdcl_learn(s, s->decision_level - 1, 0);
+  return true;
+}
+
+/* Deletes the half of the learnt clauses with the most levels, at level 0
+   when no clause is the reason of an assignment which may be analysed */
+static void cdcl_reduce(cdcl_t *s)
+{
+  size_t histogram[65] = {0};
+  size_t deletable = 0;
+
+  for (size_t clause = 0; clause < s->arena_top;
+       clause += 2 + s->arena[clause])
+  {
+    uint32_t lbd = s->arena[clause + 1];
+    if (lbd > 2)
+    {
+      histogram[lbd < 64 ? lbd : 64]++;
+      deletable++;
+    }
+  }
+
+  uint32_t threshold = 64;
+  size_t kept = 0;
+  for (uint32_t lbd = 3; lbd <= 64; lbd++)
+  {
+    kept += histogram[lbd];
+    if (kept >= deletable / 2)
+    {
+      threshold = lbd;
+      break;
+    }
+  }
+
+  size_t top = 0;
+  s->learnts = 0;
+  for (size_t clause = 0; clause < s->arena_top;)
+  {
+    uint32_t length = 2 + s->arena[clause];
+    if (s->arena[clause + 1] <= threshold)
+    {
+      memmove(&s->arena[top], &s->arena[clause], length * sizeof(uint32_t));
+      top += length;
+      s->learnts++;
+    }
+    clause += length;
+  }
+  s->arena_top = top;
+
+  for (size_t literal = 0; literal < 2 * s->vars; literal++)
+  {
+    s->watches[literal].count = 0;
+  }
+  for (size_t clause = 0; clause < s->arena_top;
+       clause += 2 + s->arena[clause])
+  {
+    watches_push(&s->watches[s->arena[clause + 2]], clause);
+    watches_push(&s->watches[s->arena[clause + 3]], clause);
+  }
+
+  for (size_t i = 0; i < s->trail_top; i++)
+  {
+    s->reason_kind[s->trail[i]] = reason_none;
+  }
+}
+
+/* Chooses among the unassigned cells with the fewest colors the color with
+   the highest activity (most involved in recent conflicts). Returns the
+   literal of the decision. */
+static uint32_t cdcl_decide(const cdcl_t *s)
+{
+  size_t size = s->size;
+  size_t best_count = size + 1;
+  uint32_t var = UINT32_MAX;
+
+  for (size_t cell = 0; cell < size * size; cell++)
+  {
+    if (s->cell_color[cell] != NO_COLOR || s->cell_count[cell] > best_count)
+    {
+      continue;
+    }
+
+    for (size_t color = 0; color < size; color++)
+    {
+      uint32_t other = cell * size + color;
+      if (s->value[other] == VALUE_UNDEF &&
+          (s->cell_count[cell] < best_count ||
+           s->activity[other] > s->activity[var]))
+      {
+        var = other;
+        best_count = s->cell_count[cell];
+      }
+    }
+  }
+  return 2 * var;
+}
+
+/* Writes the true colors in the grid */
+static void cdcl_write(const cdcl_t *s, grid_t *grid)
+{
+  for (size_t cell = 0; cell < s->size * s->size; cell++)
+  {
+    grid_set_cell_number(grid, cell / s->size, cell % s->size,
+                         s->cell_color[cell] + 1);
+  }
+}
+
+void cdcl_search(grid_t *grid, const mode_t mode, search_t *search,
+                 uint64_t *solution_count, FILE *output)
+{
+  size_t size = grid_get_size(grid);
+  cdcl_t *s = cdcl_alloc(size);
+  if (s == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the cdcl engine");
+  }
+
+  size_t capacity = size * size;
+  if (search->max_depth != 0 && search->max_depth < capacity)
+  {
+    capacity = search->max_depth;
+  }
+
+  for (size_t cell = 0; cell < size * size; cell++)
+  {
+    colors_t colors = grid_get_colors(grid, cell / size, cell % size);
+    for (size_t color = 0; color < size; color++)
+    {
+      if (!colors_is_in(colors, color))
+      {
+        cdcl_assign(s, 2 * (cell * size + color) + 1, reason_none, 0);
+      }
+    }
+  }
+
+  size_t restart_index = 0;
+  size_t restart_conflicts = CDCL_RESTART_BASE;
+  size_t conflicts = 0;
+
+  while (true)
+  {
+    if (!cdcl_propagate(s))
+    {
+      search->conflicts++;
+      if (s->decision_level == 0)
+      {
+        break;
+      }
+
+      size_t level = cdcl_analyze(s);
+      cdcl_learn(s, level, cdcl_lbd(s));
+
+      if (++conflicts >= restart_conflicts)
+      {
+        search->restarts++;
+        conflicts = 0;
+        restart_conflicts = CDCL_RESTART_BASE * luby(++restart_index);
+        cdcl_backjump(s, 0);
+        if (s->learnts > s->max_learnts)
+        {
+          cdcl_reduce(s);
+          s->max_learnts += s->max_learnts / 10;
+        }
+      }
+      continue;
+    }
+
+    if (s->cells_assigned == size * size)
+    {
+      (*solution_count)++;
+      cdcl_write(s, grid);
+
+      if (mode == mode_first || (mode == mode_unique && *solution_count == 2))
+      {
+        break;
+      }
+
+      if (mode == mode_all &&
+          grid_solution_found(grid, search, *solution_count, output))
+      {
+        break;
+      }
+
+      if (!cdcl_block(s))
+      {
+        break;
+      }
+      continue;
+    }
+
+    if (s->decision_level == capacity)
+    {
+      search->cut = true; /* too deep, this branch is given up */
+      if (!cdcl_block(s))
+      {
+        break;
+      }
+      continue;
+    }
+
+    search->nodes++;
+    s->decision_level++;
+    s->level_start[s->decision_level] = s->trail_top;
+    if (s->decision_level > search->depth)
+    {
+      search->depth = s->decision_level;
+    }
+    cdcl_assign(s, cdcl_decide(s), reason_none, 0);
+  }
+
+  cdcl_free(s);
+}
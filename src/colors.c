@@ -1,311 +1,344 @@
 #include "colors.h"
 
 #include <stdlib.h>
-#include <unistd.h> /* getpid() */
 
-#include <math.h>
-#include <time.h> /* random function */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h> /* _pdep_u64() */
+#endif
 
-bool seed_initialized = false;
-
-colors_t colors_full(const size_t size)
+const char *colors_backend(void)
 {
-  if (size == 0)
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("x86-64-v3"))
   {
-    return 0;
+    return "x86-64-v3 (POPCNT, LZCNT, TZCNT, BMI2)";
   }
-  if (size > MAX_COLORS - 1)
+  if (__builtin_cpu_supports("popcnt"))
   {
-    return -1ULL;
+    return "POPCNT";
   }
-  return -1ULL >> (MAX_COLORS - size);
+#endif
+  return "portable";
 }
 
-colors_t colors_empty(void) { return 0; }
-
-colors_t colors_set(const size_t color_id)
+/* Portable selection of the k-th bit set in a word: a binary search on the
+   halves of the word, counting the bits of the lower half at each step */
+static uint64_t colors_word_select_portable(const uint64_t word, const size_t k)
 {
-  if (color_id > MAX_COLORS - 1)
+  uint64_t x = word;
+  size_t rank = k;
+  size_t shift = 0;
+
+  for (size_t half = 32; half != 0; half /= 2)
   {
-    return 0;
+    uint64_t low = x & ((1ULL << half) - 1);
+    size_t low_count = colors_word_count(low);
+    if (rank >= low_count)
+    {
+      rank -= low_count;
+      x >>= half;
+      shift += half;
+    }
+    else
+    {
+      x = low;
+    }
   }
-  return 1ULL << color_id;
-}
-
-colors_t colors_add(const colors_t colors, const size_t color_id)
-{
-  return colors_set(color_id) | colors;
+  return 1ULL << shift;
 }
 
-colors_t colors_discard(const colors_t colors, const size_t color_id)
+#if defined(__x86_64__) && defined(__GNUC__)
+/* With BMI2, PDEP deposits a single bit on the k-th bit set directly */
+__attribute__((target("bmi2"))) static uint64_t
+colors_word_select_bmi2(const uint64_t word, const size_t k)
 {
-  return (~colors_set(color_id)) & colors;
+  return _pdep_u64(1ULL << k, word);
 }
+#endif
 
-bool colors_is_in(const colors_t colors, const size_t color_id)
+/* The CPU is checked on each call rather than with an ifunc resolver, which
+   runs before sanitizers are set up: the check is a load and a branch that
+   is always predicted */
+static inline uint64_t colors_word_select(const uint64_t word, const size_t k)
 {
-  return (colors & colors_set(color_id)) != 0;
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (__builtin_cpu_supports("bmi2"))
+  {
+    return colors_word_select_bmi2(word, k);
+  }
+#endif
+  return colors_word_select_portable(word, k);
 }
 
-colors_t colors_negate(const colors_t colors) { return ~colors; }
-
-colors_t colors_and(const colors_t colors1, const colors_t colors2)
+colors_t colors_select(const colors_t colors, const size_t k)
 {
-  return colors1 & colors2;
-}
+#if COLORS_WORDS == 1
+  return colors_word_select(colors, k);
+#else
+  size_t rank = k;
+  colors_t result = colors_empty();
 
-colors_t colors_or(const colors_t colors1, const colors_t colors2)
-{
-  return colors1 | colors2;
+  for (size_t w = 0; w < COLORS_WORDS; w++)
+  {
+    size_t count = colors_word_count(colors.words[w]);
+    if (rank < count)
+    {
+      result.words[w] = colors_word_select(colors.words[w], rank);
+      break;
+    }
+    rank -= count;
+  }
+  return result;
+#endif
 }
 
-colors_t colors_xor(const colors_t colors1, const colors_t colors2)
+colors_t colors_random(const colors_t colors, rng_t *rng)
 {
-  return colors1 ^ colors2;
-}
+  if (colors_is_empty(colors))
+  {
+    return colors;
+  }
 
-colors_t colors_subtract(const colors_t colors1, const colors_t colors2)
-{
-  return colors1 & (~colors2);
+  return colors_select(colors, rng_below(rng, colors_count(colors)));
 }
 
-bool colors_is_equal(const colors_t colors1, const colors_t colors2)
+COLORS_DISPATCH
+bool subgrid_consistency(colors_t cells[], const cell_index_t unit[],
+                         const size_t size)
 {
-  return colors1 == colors2;
-}
+  colors_t do_all_colors_appear = colors_empty();
+  for (size_t cell = 0; cell < size; cell++)
+  {
+    if (colors_is_empty(cells[unit[cell]]))
+    {
+      return false;
+    }
 
-bool colors_is_subset(const colors_t colors1, const colors_t colors2)
-{
-  return ((~colors2) & colors1) == 0;
-}
+    if (colors_is_singleton(cells[unit[cell]]))
+    {
+      for (size_t i = cell + 1; i < size; i++)
+      {
+        if (colors_is_equal(cells[unit[cell]], cells[unit[i]]))
+        {
+          return false;
+        }
+      }
+    }
 
-bool colors_is_singleton(const colors_t colors)
-{
-  if (colors == 0)
-  {
-    return false;
+    do_all_colors_appear = colors_or(do_all_colors_appear, cells[unit[cell]]);
   }
-  return (colors & (colors - 1)) == 0;
-}
-
-size_t colors_count(const colors_t colors)
-{
-  colors_t B5 = -1ULL >> 32;
-  colors_t B4 = B5 ^ (B5 << 16);
-  colors_t B3 = B4 ^ (B4 << 8);
-  colors_t B2 = B3 ^ (B3 << 4);
-  colors_t B1 = B2 ^ (B2 << 2);
-  colors_t B0 = B1 ^ (B1 << 1);
-  colors_t x = colors;
-  x = ((x >> 1) & B0) + (x & B0);
-  x = ((x >> 2) & B1) + (x & B1);
-  x = ((x >> 4) + x) & B2;
-  x = ((x >> 8) + x) & B3;
-  x = ((x >> 16) + x) & B4;
-  x = ((x >> 32) + x) & B5;
-  return x;
+  return colors_is_equal(do_all_colors_appear, colors_full(size));
 }
 
-colors_t colors_rightmost(const colors_t colors) { return colors & -colors; }
-
-colors_t colors_leftmost(const colors_t colors)
+/* Tries to give a color to cell 'i' of a unit, moving the cells already
+   matched along an augmenting path. match[color] is the cell which has the
+   color (or size), 'visited' receives the colors tried by the search. */
+static bool alldiff_augment(const colors_t domains[], size_t match[],
+                            const size_t size, const size_t i,
+                            colors_t *visited)
 {
-  size_t i = 0;
-  if (colors == 0)
-  {
-    return 0;
-  }
-  colors_t a = colors;
-  while (a != 0)
+  colors_t free;
+  while (!colors_is_empty(free = colors_subtract(domains[i], *visited)))
   {
-    a = a >> 1;
-    i += 1;
+    size_t color = colors_rightmost_id(free);
+    *visited = colors_add(*visited, color);
+    if (match[color] == size ||
+        alldiff_augment(domains, match, size, match[color], visited))
+    {
+      match[color] = i;
+      return true;
+    }
   }
-  return colors_set(i - 1);
+  return false;
 }
 
-colors_t colors_random(const colors_t colors)
+COLORS_DISPATCH
+bool subgrid_alldiff(colors_t cells[], const cell_index_t unit[],
+                     const size_t size)
 {
-  if (colors == 0)
+  colors_t domains[size];
+  size_t match[size];
+
+  for (size_t i = 0; i < size; i++)
   {
-    return 0;
+    domains[i] = cells[unit[i]];
+    match[i] = size;
   }
 
-  /* Let's put all the colors of colors in the smallest array */
-  size_t size_of_array = colors_count(colors);
-  size_t T[size_of_array];
-  int k = 0;
-
-  for (size_t i = 0; i < MAX_COLORS; i++)
+  for (size_t i = 0; i < size; i++)
   {
-    if (colors_is_in(colors, i))
+    colors_t visited = colors_empty();
+    if (!alldiff_augment(domains, match, size, i, &visited))
     {
-      T[k] = i;
-      k++;
+      cells[unit[i]] = colors_empty(); /* the unit has no solution */
+      return true;
     }
   }
 
-  if (!seed_initialized)
-  {
-    srand((time(NULL) * getpid()) % MAX_COLORS);
-    seed_initialized = true;
-  }
-
-  int a = rand() % size_of_array;
-  return colors_set(T[a]);
-}
-
-bool subgrid_consistency(colors_t *subgrid[], const size_t size)
-{
-  colors_t do_all_colors_appear = colors_empty();
-  for (size_t cell = 0; cell < size; cell++)
+  /* The matching gives each color to a cell: in the graph whose nodes are
+     the colors, going from a color to the other colors of its cell, a cell
+     can take a color of another cell only if both colors are in the same
+     strongly connected component (the cells of the component can exchange
+     their colors along a cycle) */
+  colors_t reach[size];
+  for (size_t color = 0; color < size; color++)
   {
-    if (*subgrid[cell] == colors_empty())
+    colors_t seen = colors_set(color);
+    colors_t frontier = seen;
+    while (!colors_is_empty(frontier))
     {
-      return false;
+      size_t next = colors_rightmost_id(frontier);
+      colors_t found = colors_subtract(domains[match[next]], seen);
+      frontier = colors_or(colors_discard(frontier, next), found);
+      seen = colors_or(seen, found);
     }
+    reach[color] = seen;
+  }
 
-    if (colors_is_singleton(*subgrid[cell]))
+  bool changed = false;
+  for (size_t color = 0; color < size; color++)
+  {
+    colors_t component = colors_empty();
+    for (colors_t others = reach[color]; !colors_is_empty(others);)
     {
-      for (size_t i = cell + 1; i < size; i++)
+      size_t other = colors_rightmost_id(others);
+      others = colors_discard(others, other);
+      if (colors_is_in(reach[other], color))
       {
-        if (*subgrid[cell] == *subgrid[i])
-        {
-          return false;
-        }
+        component = colors_add(component, other);
       }
     }
 
-    do_all_colors_appear = colors_or(do_all_colors_appear, *subgrid[cell]);
+    colors_t kept = colors_and(domains[match[color]], component);
+    if (!colors_is_equal(kept, domains[match[color]]))
+    {
+      cells[unit[match[color]]] = kept;
+      changed = true;
+    }
   }
-  return (do_all_colors_appear == colors_full(size));
+
+  return changed;
 }
 
-bool subgrid_heuristics(colors_t *subgrid[], size_t size)
+COLORS_DISPATCH
+bool subgrid_crosshatching(colors_t cells[], const cell_index_t unit[],
+                           const size_t size)
 {
   bool changed = false;
-  colors_t color = 0;
-  size_t count;
-
-  /* ========================= cross-hatching ========================= */
+  colors_t color = colors_empty();
 
   for (size_t i = 0; i < size; i++)
   {
-    if (colors_is_singleton(*subgrid[i]))
+    if (colors_is_singleton(cells[unit[i]]))
     {
-      color = colors_or(color, *subgrid[i]);
+      color = colors_or(color, cells[unit[i]]);
     }
   }
 
   for (size_t i = 0; i < size; i++)
   {
-    if (!colors_is_singleton(*subgrid[i]))
+    if (!colors_is_singleton(cells[unit[i]]))
     {
-      if (colors_and(*subgrid[i], color) != 0)
+      if (!colors_is_empty(colors_and(cells[unit[i]], color)))
       {
-        *subgrid[i] = colors_subtract(*subgrid[i], color);
+        cells[unit[i]] = colors_subtract(cells[unit[i]], color);
         changed = true;
       }
     }
   }
 
-  if (changed) /* (1) */
-  {
-    return true;
-  }
-
-  /* ========================= lone number ========================== */
-  int occurence_count[size];
+  return changed;
+}
 
+/* Transposed view of a unit: the positions (as a set of indexes in the
+   unit) where each color is still possible. Singletons are left out, their
+   colors being isolated by cross-hatching. */
+COLORS_DISPATCH
+static void subgrid_positions(const colors_t cells[], const cell_index_t unit[],
+                              const size_t size, colors_t positions[])
+{
   for (size_t i = 0; i < size; i++)
   {
-    occurence_count[i] = 0;
+    positions[i] = colors_empty();
   }
 
-  size_t bit_position = 0;
-
   for (size_t i = 0; i < size; i++)
   {
-    color = *subgrid[i];
+    colors_t color = cells[unit[i]];
     if (!colors_is_singleton(color))
     {
-      /* No need to deal with singletons because we called cross-hatching as
-         many time as needed to make them unique and isolated, thanks to (1) */
-      while (color != 0)
+      while (!colors_is_empty(color))
       {
-        /* We want to increment by 1 the counts of all colours
-               appearing in color, let's think about bits !   */
-        if ((color & 1) == 1)
-        {
-          occurence_count[bit_position]++;
-        }
-        color = (color >> 1);
-        bit_position++;
+        size_t color_id = colors_rightmost_id(color);
+        positions[color_id] = colors_add(positions[color_id], i);
+        color = colors_discard(color, color_id);
       }
-      bit_position = 0;
     }
   }
+}
+
+COLORS_DISPATCH
+bool subgrid_hidden_singles(colors_t cells[], const cell_index_t unit[],
+                            const size_t size)
+{
+  bool changed = false;
+  colors_t positions[size];
+  subgrid_positions(cells, unit, size, positions);
 
   for (size_t i = 0; i < size; i++)
   {
-    if (occurence_count[i] == 1) /* The key point */
+    if (colors_is_singleton(positions[i])) /* The key point */
     {
-      color = colors_set(i);
-      for (size_t j = 0; j < size; j++)
-      {
-        if (colors_is_subset(color, *subgrid[j]))
-        {
-          changed = true;
-          *subgrid[j] = color;
-          break; /* There was only 1 cell to change */
-        }
-      }
+      cells[unit[colors_rightmost_id(positions[i])]] = colors_set(i);
+      changed = true;
     }
   }
 
-  if (changed)
-  {
-    return true;
-  }
-
-  /* ========================= naked-subset ========================== */
+  return changed;
+}
 
-  count = 1;
-  colors_t memory[size / 2];
+COLORS_DISPATCH
+bool subgrid_naked_subsets(colors_t cells[], const cell_index_t unit[],
+                           const size_t size)
+{
+  bool changed = false;
+  size_t count = 1;
+  colors_t memory[size];
   size_t size_memory = 0;
 
   for (size_t i = 0; i < size; i++)
   {
-    if (!colors_is_singleton(*subgrid[i]))
+    if (!colors_is_singleton(cells[unit[i]]))
     {
       for (size_t j = 0; j < size_memory; j++)
       {
-        if (*subgrid[i] == memory[j])
+        if (colors_is_equal(cells[unit[i]], memory[j]))
         {
           goto no_need;
         }
       }
 
-      memory[size_memory] = *subgrid[i];
+      memory[size_memory] = cells[unit[i]];
       size_memory++;
 
       for (size_t j = 0; j < size; j++)
       {
-        if ((i != j) && (*subgrid[i] == *subgrid[j]))
+        if ((i != j) && colors_is_equal(cells[unit[i]], cells[unit[j]]))
         {
           count++;
         }
       }
 
-      if (count == colors_count(*subgrid[i]))
+      if (count == colors_count(cells[unit[i]]))
       {
         for (size_t j = 0; j < size; j++)
         {
-          if (colors_is_subset(*subgrid[i], *subgrid[j]) &&
-              (*subgrid[i] != *subgrid[j]))
+          if (colors_is_subset(cells[unit[i]], cells[unit[j]]) &&
+              !colors_is_equal(cells[unit[i]], cells[unit[j]]))
           {
             changed = true;
-            *subgrid[j] = colors_xor(*subgrid[i], *subgrid[j]);
+            cells[unit[j]] = colors_xor(cells[unit[i]], cells[unit[j]]);
           }
         }
       }
@@ -315,52 +348,91 @@ bool subgrid_heuristics(colors_t *subgrid[], size_t size)
   }
 
   return changed;
+}
 
-  /* I'm not removing the code of hidden-subset but I don't
-     use it, you can read my report to know why            */
-
-  if (changed)
+/* Removes from the cells of a unit at 'positions' the colors which are not
+   in 'colors', returns true if a cell has changed */
+static bool subgrid_restrict(colors_t cells[], const cell_index_t unit[],
+                             colors_t positions, const colors_t colors)
+{
+  bool changed = false;
+  while (!colors_is_empty(positions))
   {
-    return true;
+    size_t i = colors_rightmost_id(positions);
+    positions = colors_discard(positions, i);
+    if (!colors_is_subset(cells[unit[i]], colors))
+    {
+      cells[unit[i]] = colors_and(cells[unit[i]], colors);
+      changed = true;
+    }
   }
+  return changed;
+}
 
-  /* ========================= hidden-subset ========================== */
+/* k colors which are possible in only k cells (k = 2 or 3) are the only
+   colors of these cells. Thanks to the transposed view, a subset is a union
+   of positions: only colors with 2 or 3 positions can be part of one, and
+   pairs spread over more than 3 cells are discarded at once. */
+COLORS_DISPATCH
+bool subgrid_hidden_subsets(colors_t cells[], const cell_index_t unit[],
+                            const size_t size)
+{
+  bool changed = false;
+  colors_t positions[size];
+  size_t candidates[size];
+  size_t candidates_count = 0;
 
-  count = 0;
-  size_t N; /* The N candidates from the Homework 4 subject */
+  subgrid_positions(cells, unit, size, positions);
 
   for (size_t i = 0; i < size; i++)
   {
-    for (size_t j = 0; j < size; j++)
+    size_t count = colors_count(positions[i]);
+    if (count >= 2 && count <= 3)
     {
-      if ((j != i) && (colors_and(*subgrid[i], *subgrid[j]) != 0) &&
-          (!colors_is_singleton(colors_and(*subgrid[i], *subgrid[j]))))
+      candidates[candidates_count++] = i;
+    }
+  }
+
+  for (size_t a = 0; a < candidates_count; a++)
+  {
+    for (size_t b = a + 1; b < candidates_count; b++)
+    {
+      colors_t pair =
+          colors_or(positions[candidates[a]], positions[candidates[b]]);
+      colors_t color = colors_add(colors_set(candidates[a]), candidates[b]);
+      size_t count = colors_count(pair);
+
+      if (count == 2)
       {
-        color = colors_and(*subgrid[i], *subgrid[j]);
-        N = colors_count(color);
-        for (size_t k = 0; k < size; k++)
-        {
-          if (colors_and(color, *subgrid[k]) != 0)
-          {
-            count++;
-          }
-        }
-        if (count == N)
+        changed |= subgrid_restrict(cells, unit, pair, color);
+      }
+
+      else if (count == 3)
+      {
+        for (size_t c = b + 1; c < candidates_count; c++)
         {
-          for (size_t k = 0; k < size; k++)
+          colors_t triple = colors_or(pair, positions[candidates[c]]);
+          if (colors_count(triple) == 3)
           {
-            if ((colors_and(color, *subgrid[k]) != 0) &&
-                (colors_and(color, *subgrid[k]) != *subgrid[k]))
-            {
-              changed = true;
-              *subgrid[k] = colors_and(color, *subgrid[k]);
-            }
+            changed |= subgrid_restrict(cells, unit, triple,
+                                        colors_add(color, candidates[c]));
           }
         }
-        count = 0;
       }
     }
   }
 
   return changed;
-}
\ No newline at end of file
+}
+
+/* Each rule is applied only if the previous ones have changed nothing: the
+   colors of the singletons are then isolated, as hidden singles expect */
+COLORS_DISPATCH
+bool subgrid_heuristics(colors_t cells[], const cell_index_t unit[],
+                        const size_t size)
+{
+  return subgrid_crosshatching(cells, unit, size) ||
+         subgrid_hidden_singles(cells, unit, size) ||
+         subgrid_naked_subsets(cells, unit, size) ||
+         subgrid_hidden_subsets(cells, unit, size);
+}
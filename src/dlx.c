@@ -0,0 +1,391 @@
+#include "dlx.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <err.h>
+#include <pthread.h>
+
+#include "colors.h"
+
+/* Links of the exact cover matrix of a grid size. Node 0 is the root, nodes
+   1 to columns are the column headers, and candidate 'color' of cell 'cell'
+   is the row of 4 nodes starting at base + 4 * (cell * size + color) (base
+   being a multiple of 4, the nodes of a row are found by masking: they are
+   never unlinked from each other). */
+typedef struct
+{
+  size_t size;
+  size_t columns; /* 4 * size^2 constraints */
+  size_t base;    /* first node of the rows */
+  uint32_t *left;  /* ring of the column headers still to cover */
+  uint32_t *right;
+  uint32_t *up;
+  uint32_t *down;
+  uint32_t *column; /* header of each node */
+  uint32_t *count;  /* number of rows in each column */
+  uint32_t *stack;  /* row chosen at each depth of the search */
+} dlx_t;
+
+/* Links already allocated, indexed by grid size. The links are changed by
+   a search, so each thread has its own, freed when the thread exits by the
+   destructor of dlx_cache_key. */
+static _Thread_local dlx_t *dlx_cache[MAX_GRID_SIZE + 1];
+static pthread_key_t dlx_cache_key;
+static pthread_once_t dlx_cache_once = PTHREAD_ONCE_INIT;
+
+static inline size_t dlx_next(const size_t node)
+{
+  return (node & ~(size_t)3) | ((node + 1) & 3);
+}
+
+static inline size_t dlx_prev(const size_t node)
+{
+  return (node & ~(size_t)3) | ((node - 1) & 3);
+}
+
+static void dlx_free(dlx_t *dlx)
+{
+  if (dlx == NULL)
+  {
+    return;
+  }
+  free(dlx->left);
+  free(dlx->right);
+  free(dlx->up);
+  free(dlx->down);
+  free(dlx->column);
+  free(dlx->count);
+  free(dlx->stack);
+  free(dlx);
+}
+
+/* Frees the links of the cache of a thread which exits */
+static void dlx_cache_free(void *cache)
+{
+  dlx_t **links = cache;
+  for (size_t size = 0; size <= MAX_GRID_SIZE; size++)
+  {
+    dlx_free(links[size]);
+    links[size] = NULL;
+  }
+}
+
+static void dlx_cache_key_create(void)
+{
+  if (pthread_key_create(&dlx_cache_key, dlx_cache_free) != 0)
+  {
+    errx(EXIT_FAILURE, "Error: Impossible to create a thread key");
+  }
+}
+
+static dlx_t *dlx_build(const size_t size)
+{
+  size_t sqr = 1;
+  while ((sqr + 1) * (sqr + 1) <= size)
+  {
+    sqr++;
+  }
+
+  size_t cells_count = size * size;
+  size_t columns = 4 * cells_count;
+  size_t base = (columns + 1 + 3) & ~(size_t)3;
+  size_t nodes = base + 4 * cells_count * size;
+
+  dlx_t *dlx = malloc(sizeof(dlx_t));
+  if (dlx == NULL)
+  {
+    return NULL;
+  }
+
+  dlx->size = size;
+  dlx->columns = columns;
+  dlx->base = base;
+  dlx->left = malloc((columns + 1) * sizeof(uint32_t));
+  dlx->right = malloc((columns + 1) * sizeof(uint32_t));
+  dlx->up = malloc(nodes * sizeof(uint32_t));
+  dlx->down = malloc(nodes * sizeof(uint32_t));
+  dlx->column = malloc(nodes * sizeof(uint32_t));
+  dlx->count = malloc((columns + 1) * sizeof(uint32_t));
+  dlx->stack = malloc(cells_count * sizeof(uint32_t));
+
+  if (dlx->left == NULL || dlx->right == NULL || dlx->up == NULL ||
+      dlx->down == NULL || dlx->column == NULL || dlx->count == NULL ||
+      dlx->stack == NULL)
+  {
+    dlx_free(dlx);
+    return NULL;
+  }
+
+  /* The column of a node never changes, only the other links are set again
+     for each grid */
+  for (size_t header = 0; header <= columns; header++)
+  {
+    dlx->column[header] = header;
+  }
+
+  for (size_t row = 0; row < size; row++)
+  {
+    for (size_t col = 0; col < size; col++)
+    {
+      size_t cell = row * size + col;
+      size_t block = (row / sqr) * sqr + col / sqr;
+      for (size_t color = 0; color < size; color++)
+      {
+        size_t node = base + 4 * (cell * size + color);
+        dlx->column[node] = 1 + cell;
+        dlx->column[node + 1] = 1 + cells_count + row * size + color;
+        dlx->column[node + 2] = 1 + 2 * cells_count + col * size + color;
+        dlx->column[node + 3] = 1 + 3 * cells_count + block * size + color;
+      }
+    }
+  }
+
+  return dlx;
+}
+
+static dlx_t *dlx_get(const size_t size)
+{
+  if (size == 0 || size > MAX_GRID_SIZE)
+  {
+    return NULL;
+  }
+
+  if (dlx_cache[size] == NULL)
+  {
+    dlx_cache[size] = dlx_build(size);
+    pthread_once(&dlx_cache_once, dlx_cache_key_create);
+    pthread_setspecific(dlx_cache_key, dlx_cache);
+  }
+  return dlx_cache[size];
+}
+
+static void dlx_cover(dlx_t *dlx, const size_t header)
+{
+  dlx->right[dlx->left[header]] = dlx->right[header];
+  dlx->left[dlx->right[header]] = dlx->left[header];
+
+  for (size_t i = dlx->down[header]; i != header; i = dlx->down[i])
+  {
+    for (size_t j = dlx_next(i); j != i; j = dlx_next(j))
+    {
+      dlx->down[dlx->up[j]] = dlx->down[j];
+      dlx->up[dlx->down[j]] = dlx->up[j];
+      dlx->count[dlx->column[j]]--;
+    }
+  }
+}
+
+static void dlx_uncover(dlx_t *dlx, const size_t header)
+{
+  for (size_t i = dlx->up[header]; i != header; i = dlx->up[i])
+  {
+    for (size_t j = dlx_prev(i); j != i; j = dlx_prev(j))
+    {
+      dlx->count[dlx->column[j]]++;
+      dlx->down[dlx->up[j]] = j;
+      dlx->up[dlx->down[j]] = j;
+    }
+  }
+
+  dlx->right[dlx->left[header]] = header;
+  dlx->left[dlx->right[header]] = header;
+}
+
+/* Covers the other columns of a chosen row */
+static void dlx_select(dlx_t *dlx, const size_t node)
+{
+  for (size_t j = dlx_next(node); j != node; j = dlx_next(j))
+  {
+    dlx_cover(dlx, dlx->column[j]);
+  }
+}
+
+static void dlx_unselect(dlx_t *dlx, const size_t node)
+{
+  for (size_t j = dlx_prev(node); j != node; j = dlx_prev(j))
+  {
+    dlx_uncover(dlx, dlx->column[j]);
+  }
+}
+
+/* Links the rows of the candidates of a grid, and selects the rows of its
+   singletons. Returns false if two singletons are in conflict. */
+static bool dlx_reset(dlx_t *dlx, const grid_t *grid)
+{
+  size_t size = dlx->size;
+
+  for (size_t header = 0; header <= dlx->columns; header++)
+  {
+    dlx->left[header] = (header == 0) ? dlx->columns : header - 1;
+    dlx->right[header] = (header == dlx->columns) ? 0 : header + 1;
+    dlx->up[header] = header;
+    dlx->down[header] = header;
+    dlx->count[header] = 0;
+  }
+
+  /* Rows are appended in increasing order, the up link of a header being
+     the last node of its column */
+  for (size_t cell = 0; cell < size * size; cell++)
+  {
+    colors_t colors = grid_get_colors(grid, cell / size, cell % size);
+    for (size_t color = 0; color < size; color++)
+    {
+      if (!colors_is_in(colors, color))
+      {
+        continue;
+      }
+
+      size_t node = dlx->base + 4 * (cell * size + color);
+      for (size_t k = 0; k < 4; k++, node++)
+      {
+        size_t header = dlx->column[node];
+        dlx->up[node] = dlx->up[header];
+        dlx->down[node] = header;
+        dlx->down[dlx->up[header]] = node;
+        dlx->up[header] = node;
+        dlx->count[header]++;
+      }
+    }
+  }
+
+  for (size_t cell = 0; cell < size * size; cell++)
+  {
+    colors_t colors = grid_get_colors(grid, cell / size, cell % size);
+    if (!colors_is_singleton(colors))
+    {
+      continue;
+    }
+
+    size_t node = dlx->base + 4 * (cell * size + colors_rightmost_id(colors));
+
+    /* A row removed by another singleton is unlinked from its cell column */
+    if (dlx->down[dlx->up[node]] != node)
+    {
+      return false;
+    }
+    dlx_cover(dlx, dlx->column[node]);
+    dlx_select(dlx, node);
+  }
+
+  return true;
+}
+
+/* Writes the chosen rows in the grid */
+static void dlx_write(const dlx_t *dlx, grid_t *grid, const size_t depth)
+{
+  for (size_t i = 0; i < depth; i++)
+  {
+    size_t candidate = (dlx->stack[i] - dlx->base) / 4;
+    size_t cell = candidate / dlx->size;
+    grid_set_cell_number(grid, cell / dlx->size, cell % dlx->size,
+                         candidate % dlx->size + 1);
+  }
+}
+
+/* Returns the column with the fewest rows */
+static size_t dlx_choose(const dlx_t *dlx)
+{
+  size_t best = dlx->right[0];
+  for (size_t header = dlx->right[best]; header != 0 && dlx->count[best] > 1;
+       header = dlx->right[header])
+  {
+    if (dlx->count[header] < dlx->count[best])
+    {
+      best = header;
+    }
+  }
+  return best;
+}
+
+void dlx_search(grid_t *grid, const mode_t mode, search_t *search,
+                uint64_t *solution_count, FILE *output)
+{
+  dlx_t *dlx = dlx_get(grid_get_size(grid));
+  if (dlx == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the links of a grid");
+  }
+
+  if (!dlx_reset(dlx, grid))
+  {
+    search->nodes++;
+    return;
+  }
+
+  size_t capacity = dlx->size * dlx->size;
+  if (search->max_depth != 0 && search->max_depth < capacity)
+  {
+    capacity = search->max_depth;
+  }
+  size_t depth = 0;
+
+  while (true)
+  {
+    search->nodes++;
+
+    if (dlx->right[0] == 0)
+    {
+      (*solution_count)++;
+      dlx_write(dlx, grid, depth);
+
+      if (mode == mode_first || (mode == mode_unique && *solution_count == 2))
+      {
+        break;
+      }
+
+      if (mode == mode_all &&
+          grid_solution_found(grid, search, *solution_count, output))
+      {
+        break;
+      }
+    }
+
+    else
+    {
+      size_t header = dlx_choose(dlx);
+
+      if (dlx->count[header] != 0)
+      {
+        if (depth < capacity)
+        {
+          dlx_cover(dlx, header);
+          dlx->stack[depth] = dlx->down[header];
+          dlx_select(dlx, dlx->stack[depth]);
+          depth++;
+          if (depth > search->depth)
+          {
+            search->depth = depth;
+          }
+          continue;
+        }
+
+        search->cut = true; /* too deep, this branch is given up */
+      }
+    }
+
+    /* Dead end, or solution already counted: let's go back to the last
+       chosen row and try the next row of its column */
+    while (depth != 0)
+    {
+      size_t node = dlx->stack[depth - 1];
+      dlx_unselect(dlx, node);
+      node = dlx->down[node];
+
+      if (node != dlx->column[node])
+      {
+        dlx->stack[depth - 1] = node;
+        dlx_select(dlx, node);
+        break;
+      }
+
+      dlx_uncover(dlx, node);
+      depth--;
+    }
+
+    if (depth == 0)
+    {
+      break;
+    }
+  }
+}
@@ -3,18 +3,99 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <math.h>
+#include <err.h>
+#include <pthread.h>
 
+#include <string.h> /* memcpy(), memset() */
+#include <time.h>
+
+#include "cdcl.h"
 #include "colors.h"
+#include "dlx.h"
+#include "parallel.h"
+#include "units.h"
+
+/* Header of the packed format (see grid_set_packed()) */
+#define PACKED_HEADER 8
+#define PACKED_VERSION 1
+
+/* Cache line size, used to align grids in memory */
+#define GRID_ALIGNMENT 64
+
+/* Accesses a cell of a grid stored as a flat row-major array */
+#define GRID_CELL(grid, row, column) \
+  ((grid)->cells[(row) * (grid)->size + (column)])
+
+/* Color of each character plus one, 0 for the characters which are not in
+   color_table */
+static const unsigned char color_ids[256] = {
+    ['1'] = 1,  ['2'] = 2,  ['3'] = 3,  ['4'] = 4,  ['5'] = 5,  ['6'] = 6,
+    ['7'] = 7,  ['8'] = 8,  ['9'] = 9,  ['A'] = 10, ['B'] = 11, ['C'] = 12,
+    ['D'] = 13, ['E'] = 14, ['F'] = 15, ['G'] = 16, ['H'] = 17, ['I'] = 18,
+    ['J'] = 19, ['K'] = 20, ['L'] = 21, ['M'] = 22, ['N'] = 23, ['O'] = 24,
+    ['P'] = 25, ['Q'] = 26, ['R'] = 27, ['S'] = 28, ['T'] = 29, ['U'] = 30,
+    ['V'] = 31, ['W'] = 32, ['X'] = 33, ['Y'] = 34, ['Z'] = 35, ['@'] = 36,
+    ['a'] = 37, ['b'] = 38, ['c'] = 39, ['d'] = 40, ['e'] = 41, ['f'] = 42,
+    ['g'] = 43, ['h'] = 44, ['i'] = 45, ['j'] = 46, ['k'] = 47, ['l'] = 48,
+    ['m'] = 49, ['n'] = 50, ['o'] = 51, ['p'] = 52, ['q'] = 53, ['r'] = 54,
+    ['s'] = 55, ['t'] = 56, ['u'] = 57, ['v'] = 58, ['w'] = 59, ['x'] = 60,
+    ['y'] = 61, ['z'] = 62, ['&'] = 63, ['*'] = 64};
+
+/* Buffer where grid_print() formats a grid, kept from one grid to the next
+   by each thread and freed when the thread exits by the destructor of
+   print_key */
+static _Thread_local char *print_buffer = NULL;
+static _Thread_local size_t print_capacity = 0;
+static pthread_key_t print_key;
+static pthread_once_t print_once = PTHREAD_ONCE_INIT;
+
+/* Entry of the trail (undo log): a cell and its color set before a change */
+typedef struct
+{
+  size_t cell;
+  colors_t old;
+} trail_entry_t;
+
+/* Cells of a grid sorted by number of candidates, kept up to date during a
+   search. Each count from 0 to size has a circular doubly-linked list whose
+   sentinel node is number cells_count + count, cells being nodes 0 to
+   cells_count - 1. */
+typedef struct
+{
+  size_t unsolved; /* number of cells which are not singletons */
+  choice_policy_t tie_break;
+  cell_index_t *next;
+  cell_index_t *prev;
+  unsigned char *count; /* current list of each cell */
+} buckets_t;
 
-/* Internal structure (hidden from outside) for a sudoku grid */
+/* Internal structure (hidden from outside) for a sudoku grid.
+   The header and the cells live in the same cache-line aligned block, so a
+   grid is allocated with a single call and copied with a single memcpy. */
 
 struct _grid_t
 {
   size_t size;
-  colors_t **cells;
+  size_t bytes; /* size of the whole block (header and cells) */
+  bool numeric; /* colors are printed as numbers */
+  bool line;    /* the grid is printed on a single line */
+  bool packed;  /* the grid is printed packed (see grid_set_packed()) */
+  const units_t *units;
+  trail_entry_t *trail; /* NULL while changes are not recorded */
+  size_t trail_top;
+  size_t trail_capacity;
+  buckets_t *buckets; /* NULL outside of a search */
+  _Alignas(GRID_ALIGNMENT) colors_t cells[];
 };
 
+/* Returns the number of bytes needed by a grid of a given size, rounded up to
+   a multiple of GRID_ALIGNMENT as required by aligned_alloc() */
+static size_t grid_bytes(const size_t size)
+{
+  size_t bytes = sizeof(struct _grid_t) + size * size * sizeof(colors_t);
+  return (bytes + GRID_ALIGNMENT - 1) / GRID_ALIGNMENT * GRID_ALIGNMENT;
+}
+
 grid_t *grid_alloc(size_t size)
 {
   if (!grid_check_size(size))
@@ -22,76 +103,426 @@ grid_t *grid_alloc(size_t size)
     return NULL;
   }
 
-  grid_t *ptr = malloc(sizeof(struct _grid_t));
+  const units_t *units = units_get(size);
+
+  if (units == NULL)
+  {
+    return NULL;
+  }
+
+  size_t bytes = grid_bytes(size);
+  grid_t *ptr = aligned_alloc(GRID_ALIGNMENT, bytes);
 
   if (ptr == NULL)
   {
     return NULL;
   }
 
+  memset(ptr, 0, bytes);
   ptr->size = size;
-  colors_t **ptr2 = calloc(size, sizeof(colors_t *));
+  ptr->bytes = bytes;
+  ptr->units = units;
+  ptr->numeric = (size > TABLE_COLORS);
+  return ptr;
+}
 
-  if (ptr2 == NULL)
+void grid_free(grid_t *grid)
+{
+  if (grid != NULL)
   {
-    free(ptr);
-    return NULL;
+    free(grid->trail);
+    free(grid->buckets);
+    free(grid);
+  }
+}
+
+bool grid_trail_enable(grid_t *grid)
+{
+  if (grid->trail != NULL)
+  {
+    return true;
+  }
+
+  /* Most searches stay far below the worst case (size^3 entries, as every
+     entry is a strict shrink of a cell), the trail grows when needed */
+  grid->trail_capacity = grid->size * grid->size;
+  grid->trail = malloc(grid->trail_capacity * sizeof(trail_entry_t));
+  grid->trail_top = 0;
+  return (grid->trail != NULL);
+}
+
+size_t grid_trail_mark(const grid_t *grid) { return grid->trail_top; }
+
+/* Moves a cell to the bucket of its new number of candidates */
+COLORS_DISPATCH
+static void buckets_update(grid_t *grid, const size_t cell)
+{
+  buckets_t *buckets = grid->buckets;
+  size_t count = colors_count(grid->cells[cell]);
+  size_t old_count = buckets->count[cell];
+
+  if (count == old_count)
+  {
+    return;
+  }
+
+  buckets->next[buckets->prev[cell]] = buckets->next[cell];
+  buckets->prev[buckets->next[cell]] = buckets->prev[cell];
+
+  size_t head = grid->size * grid->size + count;
+  buckets->next[cell] = buckets->next[head];
+  buckets->prev[cell] = head;
+  buckets->prev[buckets->next[head]] = cell;
+  buckets->next[head] = cell;
+  buckets->count[cell] = count;
+
+  buckets->unsolved += (count != 1);
+  buckets->unsolved -= (old_count != 1);
+}
+
+void grid_trail_undo(grid_t *grid, const size_t mark)
+{
+  while (grid->trail_top > mark)
+  {
+    grid->trail_top--;
+    size_t cell = grid->trail[grid->trail_top].cell;
+    grid->cells[cell] = grid->trail[grid->trail_top].old;
+    if (grid->buckets != NULL)
+    {
+      buckets_update(grid, cell);
+    }
+  }
+}
+
+/* Records the color set of a cell before a change, if the grid has a trail */
+static void grid_trail_push(grid_t *grid, const size_t cell,
+                            const colors_t old)
+{
+  if (grid->trail == NULL)
+  {
+    return;
+  }
+
+  if (grid->trail_top == grid->trail_capacity)
+  {
+    size_t capacity = 2 * grid->trail_capacity;
+    trail_entry_t *trail =
+        realloc(grid->trail, capacity * sizeof(trail_entry_t));
+    if (trail == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the trail of a grid");
+    }
+    grid->trail = trail;
+    grid->trail_capacity = capacity;
+  }
+
+  grid->trail[grid->trail_top].cell = cell;
+  grid->trail[grid->trail_top].old = old;
+  grid->trail_top++;
+}
+
+/* Must be called after each change of a cell during a search: records its
+   old color set in the trail and moves it to its new bucket */
+static void grid_cell_changed(grid_t *grid, const size_t cell,
+                              const colors_t old)
+{
+  grid_trail_push(grid, cell, old);
+  if (grid->buckets != NULL)
+  {
+    buckets_update(grid, cell);
   }
+}
 
-  for (size_t i = 0; i < size; i++)
+/* Sorts the cells of a grid in buckets, for the time of a search */
+COLORS_DISPATCH
+static void buckets_build(grid_t *grid, const choice_policy_t tie_break)
+{
+  size_t cells_count = grid->size * grid->size;
+  size_t nodes = cells_count + grid->size + 1;
+  buckets_t *buckets = malloc(sizeof(buckets_t) +
+                              2 * nodes * sizeof(cell_index_t) + cells_count);
+  if (buckets == NULL)
   {
-    ptr2[i] = calloc(size, sizeof(colors_t));
-    if (ptr2[i] == NULL)
+    err(EXIT_FAILURE, "Error: Impossible to alloc the buckets of a grid");
+  }
+
+  buckets->next = (cell_index_t *)(buckets + 1);
+  buckets->prev = buckets->next + nodes;
+  buckets->count = (unsigned char *)(buckets->prev + nodes);
+  buckets->unsolved = 0;
+  buckets->tie_break = tie_break;
+
+  for (size_t head = cells_count; head < nodes; head++)
+  {
+    buckets->next[head] = head;
+    buckets->prev[head] = head;
+  }
+
+  /* Cells are inserted in reverse order so that each list is sorted by
+     position at first */
+  for (size_t cell = cells_count; cell-- > 0;)
+  {
+    size_t count = colors_count(grid->cells[cell]);
+    size_t head = cells_count + count;
+    buckets->next[cell] = buckets->next[head];
+    buckets->prev[cell] = head;
+    buckets->prev[buckets->next[head]] = cell;
+    buckets->next[head] = cell;
+    buckets->count[cell] = count;
+    buckets->unsolved += (count != 1);
+  }
+
+  grid->buckets = buckets;
+}
+
+static void buckets_free(grid_t *grid)
+{
+  free(grid->buckets);
+  grid->buckets = NULL;
+}
+
+/* Returns the number of unsolved peers of a cell */
+COLORS_DISPATCH
+static size_t grid_cell_degree(const grid_t *grid, const size_t cell)
+{
+  const cell_index_t *peers = units_peers(grid->units, cell);
+  size_t degree = 0;
+  for (size_t i = 0; i < grid->units->peers_count; i++)
+  {
+    degree += !colors_is_singleton(grid->cells[peers[i]]);
+  }
+  return degree;
+}
+
+/* Returns the unsolved cell with the fewest candidates, ties being broken
+   according to the policy of the buckets */
+static size_t buckets_choice(const grid_t *grid)
+{
+  const buckets_t *buckets = grid->buckets;
+  size_t cells_count = grid->size * grid->size;
+  size_t head = cells_count + 2;
+
+  while (buckets->next[head] == head)
+  {
+    head++;
+  }
+
+  size_t best = buckets->next[head];
+
+  if (buckets->tie_break == choice_position)
+  {
+    for (size_t cell = buckets->next[best]; cell != head;
+         cell = buckets->next[cell])
     {
-      for (size_t j = 0; j < i; j++)
+      if (cell < best)
       {
-        free(ptr2[j]);
+        best = cell;
       }
-      free(ptr2);
-      free(ptr);
-      return NULL;
     }
   }
-  ptr->cells = ptr2;
-  return ptr;
+
+  else if (buckets->tie_break == choice_degree)
+  {
+    size_t best_degree = grid_cell_degree(grid, best);
+    for (size_t cell = buckets->next[best]; cell != head;
+         cell = buckets->next[cell])
+    {
+      size_t degree = grid_cell_degree(grid, cell);
+      if (degree > best_degree || (degree == best_degree && cell < best))
+      {
+        best = cell;
+        best_degree = degree;
+      }
+    }
+  }
+
+  return best;
 }
 
-void grid_free(grid_t *grid)
+/* Returns the number of bits of a cell in the packed format */
+static int packed_bits(const size_t size)
 {
-  if (grid != NULL)
+  int bits = 1;
+  while (((size_t)1 << bits) < size)
   {
-    for (size_t i = 0; i < grid->size; i++)
+    bits++;
+  }
+  return bits;
+}
+
+/* Returns the number of digits needed to print the numbers of a grid */
+static int grid_number_width(const grid_t *grid)
+{
+  int width = 1;
+  for (size_t n = grid->size; n >= 10; n /= 10)
+  {
+    width++;
+  }
+  return width;
+}
+
+static void grid_print_buffer_free(void *buffer)
+{
+  free(buffer);
+  print_buffer = NULL;
+  print_capacity = 0;
+}
+
+static void grid_print_key_create(void)
+{
+  if (pthread_key_create(&print_key, grid_print_buffer_free) != 0)
+  {
+    errx(EXIT_FAILURE, "Error: Impossible to create a thread key");
+  }
+}
+
+/* Returns the buffer of grid_print() of the thread, with room for 'length'
+   characters */
+static char *grid_print_buffer(const size_t length)
+{
+  if (length > print_capacity)
+  {
+    char *buffer = realloc(print_buffer, length);
+    if (buffer == NULL)
     {
-      free(grid->cells[i]);
+      err(EXIT_FAILURE, "Error: Impossible to alloc the buffer of a grid");
     }
-    free(grid->cells);
-    free(grid);
+    print_buffer = buffer;
+    print_capacity = length;
+    pthread_once(&print_once, grid_print_key_create);
+    pthread_setspecific(print_key, print_buffer);
   }
+  return print_buffer;
+}
+
+/* Writes a cell as a number 1 to size, or EMPTY_CELL if it is not a
+   singleton, right-aligned in 'width' characters at 'end'. Returns the end of
+   the cell. */
+static char *grid_encode_number(const colors_t cell, const int width,
+                                char *end)
+{
+  char *digit = end + width;
+
+  if (!colors_is_singleton(cell))
+  {
+    *--digit = EMPTY_CELL;
+  }
+  else
+  {
+    for (size_t number = colors_rightmost_id(cell) + 1; number != 0;
+         number /= 10)
+    {
+      *--digit = '0' + number % 10;
+    }
+  }
+
+  while (digit > end)
+  {
+    *--digit = ' ';
+  }
+  return end + width;
+}
+
+/* Returns the character of a cell: its color if it is a singleton, else
+   EMPTY_CELL */
+static inline char grid_encode_char(const colors_t cell)
+{
+  return colors_is_singleton(cell) ? color_table[colors_rightmost_id(cell)]
+                                   : EMPTY_CELL;
 }
 
 void grid_print(const grid_t *grid, FILE *fd)
 {
-  if (grid != NULL)
+  if (grid == NULL)
   {
-    for (size_t i = 0; i < grid->size; i++)
+    return;
+  }
+
+  /* The grid is formatted in a buffer and written at once */
+  size_t size = grid->size;
+  int width = grid->numeric ? grid_number_width(grid) : 1;
+  size_t length = grid->line ? size * size + 1
+                             : size * (size * (width + 1) + 1) + 1;
+  char *buffer = grid_print_buffer(length);
+  char *end = buffer;
+
+  if (grid->packed)
+  {
+    /* Bits of the cells go to 'bits', and leave it by bytes */
+    int cell_bits = packed_bits(size);
+    uint64_t bits = 0;
+    int count = 0;
+    *end++ = 'S';
+    for (size_t i = 0; i < size * size; i++)
     {
-      for (size_t j = 0; j < grid->size; j++)
+      if (colors_is_singleton(grid->cells[i]))
+      {
+        bits |= (uint64_t)colors_rightmost_id(grid->cells[i]) << count;
+      }
+      count += cell_bits;
+      while (count >= 8)
+      {
+        *end++ = bits & 0xff;
+        bits >>= 8;
+        count -= 8;
+      }
+    }
+    if (count > 0)
+    {
+      *end++ = bits;
+    }
+  }
+
+  else if (grid->line)
+  {
+    for (size_t i = 0; i < size * size; i++)
+    {
+      *end++ = grid_encode_char(grid->cells[i]);
+    }
+    *end++ = '\n';
+  }
+
+  else
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      for (size_t j = 0; j < size; j++)
       {
-        if (!colors_is_singleton(grid->cells[i][j]))
+        if (grid->numeric)
         {
-          fprintf(fd, "%c ", EMPTY_CELL);
+          end = grid_encode_number(GRID_CELL(grid, i, j), width, end);
         }
         else
         {
-          char *ptr = grid_get_cell(grid, i, j);
-          fprintf(fd, "%s ", ptr);
-          free(ptr);
+          *end++ = grid_encode_char(GRID_CELL(grid, i, j));
         }
+        *end++ = ' ';
       }
-      fprintf(fd, "\n");
+      *end++ = '\n';
     }
-    fprintf(fd, "\n");
+    *end++ = '\n';
+  }
+
+  fwrite(buffer, 1, end - buffer, fd);
+}
+
+void grid_print_solution(const grid_t *grid, const uint64_t number, FILE *fd)
+{
+  if (!grid->line && !grid->packed)
+  {
+    fprintf(fd, "Solution %" PRIu64 ":\n", number);
   }
+  grid_print(grid, fd);
+}
+
+bool grid_solution_found(const grid_t *grid, const search_t *search,
+                         const uint64_t number, FILE *output)
+{
+  if (!search->count_only)
+  {
+    grid_print_solution(grid, number, output);
+  }
+  return (search->max_solutions != 0 && number >= search->max_solutions);
 }
 
 void grid_print2(const grid_t *grid)
@@ -122,20 +553,23 @@ bool grid_check_char(const grid_t *grid, const char c)
   {
     return true;
   }
-  for (size_t i = 0; i < grid->size; i++)
-  {
-    if (c == color_table[i])
-    {
-      return true;
-    }
-  }
-  return false;
+  size_t id = color_ids[(unsigned char)c];
+  return (id != 0 && id <= grid->size);
 }
 
 bool grid_check_size(const size_t size)
 {
-  return (size == 1 || size == 4 || size == 9 || size == 16 || size == 25 ||
-          size == 36 || size == 49 || size == 64);
+  if (size == 0 || size > MAX_GRID_SIZE)
+  {
+    return false;
+  }
+
+  size_t sqr = 1;
+  while ((sqr + 1) * (sqr + 1) <= size)
+  {
+    sqr++;
+  }
+  return (sqr * sqr == size);
 }
 
 grid_t *grid_copy(const grid_t *grid)
@@ -145,276 +579,790 @@ grid_t *grid_copy(const grid_t *grid)
     return NULL;
   }
 
-  grid_t *copy = grid_alloc(grid->size);
+  grid_t *copy = aligned_alloc(GRID_ALIGNMENT, grid->bytes);
 
   if (copy == NULL)
   {
     return NULL;
   }
 
-  copy->size = grid->size;
+  memcpy(copy, grid, grid->bytes);
+  copy->trail = NULL; /* a copy starts without any history */
+  copy->trail_top = 0;
+  copy->trail_capacity = 0;
+  copy->buckets = NULL;
+  return copy;
+}
+
+void grid_copy2(const grid_t *grid, grid_t *copy)
+{
+  if ((grid != NULL) && (copy != NULL) && (copy->size == grid->size))
+  {
+    memcpy(copy->cells, grid->cells,
+           grid->size * grid->size * sizeof(colors_t));
+  }
+}
+
+char *grid_get_cell(const grid_t *grid, const size_t row, const size_t column)
+{
+  if (grid == NULL || (row + 1) > grid->size || (column + 1) > grid->size)
+  {
+    return NULL;
+  }
+
+  colors_t cell = GRID_CELL(grid, row, column);
+
+  /* Numbers take up to 3 digits and a separator */
+  size_t length = grid->numeric ? 4 * colors_count(cell) : colors_count(cell);
+  char *s = calloc(length + 1, sizeof(char));
+  if (s == NULL)
+  {
+    return NULL;
+  }
+  size_t s_row = 0;
+
+  for (size_t i = 0; i < grid->size; i++)
+  {
+    if (colors_is_in(cell, i))
+    {
+      if (grid->numeric)
+      {
+        s_row += sprintf(s + s_row, s_row == 0 ? "%zu" : ",%zu", i + 1);
+      }
+      else
+      {
+        s[s_row] = color_table[i];
+        s_row++;
+      }
+    }
+  }
+  return s;
+}
+
+colors_t grid_get_colors(const grid_t *grid, const size_t row,
+                         const size_t column)
+{
+  return GRID_CELL(grid, row, column);
+}
+
+size_t grid_get_size(const grid_t *grid)
+{
+  if (grid == NULL)
+  {
+    return 0;
+  }
+  return grid->size;
+}
+
+void grid_set_cell(grid_t *grid, const size_t row, const size_t column,
+                   const char color)
+{
+  if (grid != NULL && row < grid->size && column < grid->size)
+  {
+    if (color == EMPTY_CELL)
+    {
+      GRID_CELL(grid, row, column) = colors_full(grid->size);
+    }
+    else
+    {
+      /* colors_set(-1) returns 0 for a character out of color_table */
+      GRID_CELL(grid, row, column) =
+          colors_set(color_ids[(unsigned char)color] - 1);
+    }
+  }
+}
+
+void grid_set_cell_number(grid_t *grid, const size_t row, const size_t column,
+                          const size_t number)
+{
+  if (grid != NULL && row < grid->size && column < grid->size &&
+      number <= grid->size)
+  {
+    if (number == 0)
+    {
+      GRID_CELL(grid, row, column) = colors_full(grid->size);
+    }
+    else
+    {
+      GRID_CELL(grid, row, column) = colors_set(number - 1);
+    }
+  }
+}
+
+void grid_set_numeric(grid_t *grid, const bool numeric)
+{
+  if (grid != NULL)
+  {
+    grid->numeric = numeric || (grid->size > TABLE_COLORS);
+  }
+}
+
+void grid_set_line(grid_t *grid, const bool line)
+{
+  if (grid != NULL)
+  {
+    grid->line = line && (grid->size <= TABLE_COLORS);
+  }
+}
+
+void grid_set_packed(grid_t *grid, const bool packed)
+{
+  if (grid != NULL)
+  {
+    grid->packed = packed;
+  }
+}
+
+bool grid_is_solved(grid_t *grid)
+{
+  if (grid->buckets != NULL)
+  {
+    return (grid->buckets->unsolved == 0);
+  }
+
+  for (size_t row = 0; row < grid->size; row++)
+  {
+    for (size_t column = 0; column < grid->size; column++)
+    {
+      if (!colors_is_singleton(GRID_CELL(grid, row, column)))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool subgrid_apply(grid_t *grid,
+                   bool (*func)(colors_t cells[], const cell_index_t unit[],
+                                const size_t size))
+{
+  for (size_t unit = 0; unit < 3 * grid->size; unit++)
+  {
+    if (!func(grid->cells, units_unit(grid->units, unit), grid->size))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool grid_is_consistent(grid_t *grid)
+{
+  return subgrid_apply(grid, subgrid_consistency);
+}
+
+/* Units waiting to be visited by grid_heuristics(). A unit is queued again
+   only when one of its cells has lost candidates, instead of sweeping the
+   whole grid until nothing changes. Each unit is at most once in the queue,
+   so a circular buffer of 3 * size entries is enough. */
+typedef struct
+{
+  size_t *queue;
+  bool *queued;
+  size_t head;
+  size_t length;
+  size_t capacity;
+} worklist_t;
+
+static void worklist_push(worklist_t *worklist, const size_t unit)
+{
+  if (!worklist->queued[unit])
+  {
+    worklist->queued[unit] = true;
+    worklist->queue[(worklist->head + worklist->length) % worklist->capacity] =
+        unit;
+    worklist->length++;
+  }
+}
+
+static size_t worklist_pop(worklist_t *worklist)
+{
+  size_t unit = worklist->queue[worklist->head];
+  worklist->head = (worklist->head + 1) % worklist->capacity;
+  worklist->length--;
+  worklist->queued[unit] = false;
+  return unit;
+}
+
+/* Records the cells of a unit which differ from 'before' (in the trail and
+   the buckets) and queues their units. Returns the number of candidates
+   removed. */
+COLORS_DISPATCH
+static size_t grid_unit_changed(grid_t *grid, const cell_index_t cells[],
+                                const colors_t before[], worklist_t *worklist)
+{
+  size_t removed = 0;
 
   for (size_t i = 0; i < grid->size; i++)
   {
-    for (size_t j = 0; j < grid->size; j++)
+    if (colors_is_equal(grid->cells[cells[i]], before[i]))
+    {
+      continue;
+    }
+
+    removed += colors_count(before[i]) - colors_count(grid->cells[cells[i]]);
+    grid_cell_changed(grid, cells[i], before[i]);
+
+    const cell_index_t *cell_units = units_of_cell(grid->units, cells[i]);
+    for (size_t j = 0; j < 3; j++)
+    {
+      worklist_push(worklist, cell_units[j]);
+    }
+  }
+
+  return removed;
+}
+
+/* Removes colors from a cell, recording the change and queuing its units.
+   Returns the number of candidates removed. */
+COLORS_DISPATCH
+static size_t grid_cell_remove(grid_t *grid, const size_t cell,
+                               const colors_t colors, worklist_t *worklist)
+{
+  colors_t old = grid->cells[cell];
+  if (colors_is_empty(colors_and(old, colors)))
+  {
+    return 0;
+  }
+
+  grid->cells[cell] = colors_subtract(old, colors);
+  grid_cell_changed(grid, cell, old);
+
+  const cell_index_t *cell_units = units_of_cell(grid->units, cell);
+  for (size_t j = 0; j < 3; j++)
+  {
+    worklist_push(worklist, cell_units[j]);
+  }
+  return colors_count(old) - colors_count(grid->cells[cell]);
+}
+
+/* Index of the cell at position 'position' of line 'line', lines being the
+   rows (transposed = false) or the columns */
+static inline size_t line_cell(const size_t size, const bool transposed,
+                               const size_t line, const size_t position)
+{
+  return transposed ? position * size + line : line * size + position;
+}
+
+/* Intersection removal (pointing pairs and box-line reduction). A segment is
+   the intersection of a line and a block: if a color of a block appears
+   only in one of its segments, it is removed from the rest of the line, and
+   if a color of a line appears only in one of its segments, it is removed
+   from the rest of the block. All colors are handled at once by unions of
+   the segments color sets. Returns the number of candidates removed. */
+COLORS_DISPATCH
+static size_t grid_intersections(grid_t *grid, worklist_t *worklist)
+{
+  size_t size = grid->size;
+  size_t sqr = grid->units->sqr;
+  size_t removed = 0;
+  colors_t segments[size * sqr]; /* segment k of line l at l * sqr + k */
+
+  for (int transposed = 0; transposed < 2; transposed++)
+  {
+    for (size_t line = 0; line < size; line++)
+    {
+      for (size_t k = 0; k < sqr; k++)
+      {
+        colors_t segment = colors_empty();
+        for (size_t i = 0; i < sqr; i++)
+        {
+          segment = colors_or(
+              segment,
+              grid->cells[line_cell(size, transposed, line, k * sqr + i)]);
+        }
+        segments[line * sqr + k] = segment;
+      }
+    }
+
+    for (size_t line = 0; line < size; line++)
+    {
+      size_t band = line / sqr * sqr; /* first line of the blocks of line */
+
+      for (size_t k = 0; k < sqr; k++)
+      {
+        colors_t in_line = colors_empty();  /* other segments of the line */
+        colors_t in_block = colors_empty(); /* other segments of the block */
+        for (size_t i = 0; i < sqr; i++)
+        {
+          if (i != k)
+          {
+            in_line = colors_or(in_line, segments[line * sqr + i]);
+          }
+          if (band + i != line)
+          {
+            in_block = colors_or(in_block, segments[(band + i) * sqr + k]);
+          }
+        }
+
+        colors_t segment = segments[line * sqr + k];
+        colors_t pointing = colors_subtract(segment, in_block);
+        colors_t claiming = colors_subtract(segment, in_line);
+
+        if (!colors_is_empty(pointing))
+        {
+          for (size_t position = 0; position < size; position++)
+          {
+            if (position / sqr != k)
+            {
+              removed += grid_cell_remove(
+                  grid, line_cell(size, transposed, line, position), pointing,
+                  worklist);
+            }
+          }
+        }
+
+        if (!colors_is_empty(claiming))
+        {
+          for (size_t i = 0; i < sqr; i++)
+          {
+            for (size_t j = 0; j < sqr; j++)
+            {
+              if (band + i != line)
+              {
+                removed += grid_cell_remove(
+                    grid, line_cell(size, transposed, band + i, k * sqr + j),
+                    claiming, worklist);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return removed;
+}
+
+/* Fish of a color (X-Wing, Swordfish, Jellyfish... up to 'order' lines).
+   The positions of the color in each line are a bitset of the crossing
+   lines: if k base lines have their positions in only k cover lines, the
+   color is in one of the intersections of each cover line, and it is
+   removed from the rest of the cover lines. Base lines are added one by one
+   from 'start', a set whose union of positions grows beyond 'order' being
+   given up at once. Returns the number of candidates removed. */
+COLORS_DISPATCH
+static size_t grid_fish_lines(grid_t *grid, const bool transposed,
+                              const size_t color, const colors_t positions[],
+                              const size_t lines[], const size_t count,
+                              const size_t start, const size_t depth,
+                              const colors_t base, const colors_t cover,
+                              const size_t order, worklist_t *worklist)
+{
+  size_t size = grid->size;
+  size_t removed = 0;
+
+  for (size_t i = start; i < count; i++)
+  {
+    colors_t union_cover = colors_or(cover, positions[lines[i]]);
+    size_t cover_count = colors_count(union_cover);
+    if (cover_count > order)
+    {
+      continue;
+    }
+
+    colors_t union_base = colors_add(base, lines[i]);
+
+    if (cover_count == depth + 1 && depth != 0)
     {
-      copy->cells[i][j] = grid->cells[i][j];
+      for (size_t line = 0; line < size; line++)
+      {
+        if (colors_is_in(union_base, line))
+        {
+          continue;
+        }
+
+        colors_t cells = colors_and(positions[line], union_cover);
+        while (!colors_is_empty(cells))
+        {
+          size_t position = colors_rightmost_id(cells);
+          cells = colors_discard(cells, position);
+          removed += grid_cell_remove(
+              grid, line_cell(size, transposed, line, position),
+              colors_set(color), worklist);
+        }
+      }
+    }
+
+    else if (depth + 1 < order)
+    {
+      removed += grid_fish_lines(grid, transposed, color, positions, lines,
+                                 count, i + 1, depth + 1, union_base,
+                                 union_cover, order, worklist);
+    }
+  }
+
+  return removed;
+}
+
+/* Looks for fish of up to 'order' lines for every color, with rows then
+   columns as base lines. Returns the number of candidates removed. */
+COLORS_DISPATCH
+static size_t grid_fish(grid_t *grid, const size_t order, worklist_t *worklist)
+{
+  size_t size = grid->size;
+  size_t removed = 0;
+  colors_t positions[size];
+  size_t lines[size];
+
+  for (int transposed = 0; transposed < 2; transposed++)
+  {
+    for (size_t color = 0; color < size; color++)
+    {
+      size_t count = 0;
+
+      for (size_t line = 0; line < size; line++)
+      {
+        positions[line] = colors_empty();
+        for (size_t position = 0; position < size; position++)
+        {
+          if (colors_is_in(
+                  grid->cells[line_cell(size, transposed, line, position)],
+                  color))
+          {
+            positions[line] = colors_add(positions[line], position);
+          }
+        }
+
+        /* A line where the color has one place is left to the other rules */
+        size_t places = colors_count(positions[line]);
+        if (places >= 2 && places <= order)
+        {
+          lines[count++] = line;
+        }
+      }
+
+      if (count >= 2)
+      {
+        removed += grid_fish_lines(grid, transposed, color, positions, lines,
+                                   count, 0, 0, colors_empty(), colors_empty(),
+                                   order, worklist);
+      }
     }
   }
 
-  return copy;
+  return removed;
 }
 
-void grid_copy2(const grid_t *grid, grid_t *copy)
+/* Returns a time in seconds, to measure the cost of heuristics */
+static double grid_clock(void)
 {
-  if ((grid != NULL) && (copy != NULL) && (copy->size == grid->size))
-  {
-    for (size_t i = 0; i < grid->size; i++)
-    {
-      for (size_t j = 0; j < grid->size; j++)
-      {
-        copy->cells[i][j] = grid->cells[i][j];
-      }
-    }
-  }
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec * 1e-9;
 }
 
-char *grid_get_cell(const grid_t *grid, const size_t row, const size_t column)
+/* All-different filtering of each unit. Returns the number of candidates
+   removed. */
+COLORS_DISPATCH
+static size_t grid_alldiff(grid_t *grid, worklist_t *worklist)
 {
-  if (grid == NULL || (row + 1) > grid->size || (column + 1) > grid->size)
-  {
-    return NULL;
-  }
+  size_t size = grid->size;
+  size_t removed = 0;
+  colors_t before[size];
 
-  colors_t cell = grid->cells[row][column];
-  char *s = calloc(colors_count(cell) + 1, sizeof(char));
-  if (s == NULL)
+  for (size_t unit = 0; unit < 3 * size; unit++)
   {
-    return NULL;
-  }
-  size_t s_row = 0;
+    const cell_index_t *cells = units_unit(grid->units, unit);
+    for (size_t i = 0; i < size; i++)
+    {
+      before[i] = grid->cells[cells[i]];
+    }
 
-  for (size_t i = 0; i < grid->size; i++)
-  {
-    if (colors_is_in(cell, i))
+    if (subgrid_alldiff(grid->cells, cells, size))
     {
-      s[s_row] = color_table[i];
-      s_row++;
+      removed += grid_unit_changed(grid, cells, before, worklist);
     }
   }
-  return s;
+
+  return removed;
 }
 
-size_t grid_get_size(const grid_t *grid)
+static const char *const rule_names[RULES_COUNT] = {
+    [rule_hidden_singles] = "singles", [rule_naked_subsets] = "naked",
+    [rule_hidden_subsets] = "hidden",  [rule_intersections] = "intersections",
+    [rule_fish] = "fish",              [rule_alldiff] = "alldiff"};
+
+static bool (*const unit_rules[RULES_COUNT])(colors_t cells[],
+                                             const cell_index_t unit[],
+                                             const size_t size) = {
+    [rule_hidden_singles] = subgrid_hidden_singles,
+    [rule_naked_subsets] = subgrid_naked_subsets,
+    [rule_hidden_subsets] = subgrid_hidden_subsets};
+
+static const rule_t default_rules[] = {rule_hidden_singles,
+                                       rule_naked_subsets,
+                                       rule_hidden_subsets,
+                                       rule_intersections};
+
+#define DEFAULT_RULES_COUNT (sizeof(default_rules) / sizeof(default_rules[0]))
+
+/* In adaptive mode, the statistics of a rule at a depth band are trusted
+   after ADAPTIVE_WARMUP calls, and a rule turned off there is still applied
+   once every ADAPTIVE_PROBE times, so that it may be turned on again */
+#define ADAPTIVE_WARMUP 64
+#define ADAPTIVE_PROBE 16
+
+/* A unit rule is too quick to read the clock at each call: one call out of
+   TIMING_SAMPLE is timed, and counted for all of them */
+#define TIMING_SAMPLE 16
+
+void grid_rules_default(search_t *search)
 {
-  if (grid == NULL)
+  for (size_t i = 0; i < DEFAULT_RULES_COUNT; i++)
   {
-    return 0;
+    search->rules[i] = default_rules[i];
   }
-  return grid->size;
+  search->rules_count = DEFAULT_RULES_COUNT;
+  search->rules_set = true;
 }
 
-void grid_set_cell(grid_t *grid, const size_t row, const size_t column,
-                   const char color)
+void grid_rules_add(search_t *search, const rule_t rule)
 {
-  if (grid != NULL && row < grid->size && column < grid->size)
+  for (size_t i = 0; i < search->rules_count; i++)
   {
-    if (color == EMPTY_CELL)
-    {
-      grid->cells[row][column] = colors_full(grid->size);
-    }
-    else
+    if (search->rules[i] == rule)
     {
-      char c = 1;
-      size_t i = 0;
-      while (c != color)
-      {
-        c = color_table[i];
-        i++;
-      }
-      grid->cells[row][column] = colors_set(i - 1);
-      /* i - 1 because colors_set(-1) returns 0, colors_set(0) returns 1... */
+      return;
     }
   }
+  search->rules[search->rules_count++] = rule;
 }
 
-bool grid_is_solved(grid_t *grid)
+const char *grid_rule_name(const rule_t rule)
 {
-  for (size_t row = 0; row < grid->size; row++)
+  return rule_names[rule];
+}
+
+/* Returns the depth band of a level of the decision stack */
+static size_t grid_rule_band(const size_t level)
+{
+  size_t band = 0;
+  while (band < RULE_BANDS - 1 && (level >> band) != 0)
   {
-    for (size_t column = 0; column < grid->size; column++)
-    {
-      if (!colors_is_singleton(grid->cells[row][column]))
-      {
-        return false;
-      }
-    }
+    band++;
   }
-  return true;
+  return band;
 }
 
-bool subgrid_apply(grid_t *grid,
-                   bool (*func)(colors_t *subgrid[], const size_t size))
+/* Tells if a rule is applied at this node, counting the calls avoided */
+static bool grid_rule_enabled(const search_t *search, rule_stats_t *stats)
 {
-  size_t size = grid->size;
-  colors_t *subgrid[size];
-
-  /* ============================== Rows ============================== */
-  for (size_t row = 0; row < size; row++)
+  if (search->adaptive <= 0 || stats->calls < ADAPTIVE_WARMUP ||
+      stats->removed >= search->adaptive * stats->seconds * 1e6)
   {
-    for (size_t column = 0; column < size; column++)
-    {
-      subgrid[column] = &grid->cells[row][column];
-    }
-    if (!func(subgrid, size))
-    {
-      return false;
-    }
+    return true;
   }
 
-  /* ============================= Columns ============================= */
-  for (size_t column = 0; column < size; column++)
+  stats->skipped++;
+  return stats->skipped % ADAPTIVE_PROBE == 0;
+}
+
+COLORS_DISPATCH
+status_t grid_heuristics(grid_t *grid, search_t *search)
+{
+  size_t size = grid->size;
+  size_t units_count = 3 * size;
+  size_t queue[units_count];
+  bool queued[units_count];
+  worklist_t worklist = {.queue = queue,
+                         .queued = queued,
+                         .head = 0,
+                         .length = 0,
+                         .capacity = units_count};
+  colors_t before[size];
+  bool fished = false; /* the fish have removed candidates */
+
+  /* Rules of the pipeline applied at this node, split between unit and grid
+     rules, with the statistics of their depth band */
+  const rule_t *rules = default_rules;
+  size_t rules_count = DEFAULT_RULES_COUNT;
+  if (search != NULL && search->rules_set)
   {
-    for (size_t row = 0; row < size; row++)
-    {
-      subgrid[row] = &grid->cells[row][column];
-    }
-    if (!func(subgrid, size))
-    {
-      return false;
-    }
+    rules = search->rules;
+    rules_count = search->rules_count;
   }
 
-  /* ============================= Blocks ============================= */
-  size_t sqr = sqrt(size);
-  size_t block_row = 0;
-  size_t block_column = 0;
-  for (size_t block = 0; block < size; block++)
+  rule_t unit_pipeline[RULES_COUNT];
+  rule_t grid_pipeline[RULES_COUNT];
+  rule_stats_t *stats[RULES_COUNT] = {NULL};
+  size_t unit_count = 0;
+  size_t grid_count = 0;
+
+  for (size_t i = 0; i < rules_count; i++)
   {
-    for (size_t i = 0; i < sqr; i++)
+    rule_t rule = rules[i];
+    if (search != NULL)
     {
-      for (size_t j = 0; j < sqr; j++)
+      stats[rule] = &search->rules_stats[rule][grid_rule_band(search->level)];
+      if (!grid_rule_enabled(search, stats[rule]))
       {
-        subgrid[sqr * i + j] = &grid->cells[block_row + i][block_column + j];
+        continue;
       }
     }
 
-    if (!func(subgrid, size))
-    {
-      return false;
-    }
-
-    if (block_column < size - sqr)
+    if (unit_rules[rule] != NULL)
     {
-      block_column += sqr;
+      unit_pipeline[unit_count++] = rule;
     }
     else
     {
-      block_column = 0;
-      block_row += sqr;
+      grid_pipeline[grid_count++] = rule;
     }
   }
-  return true;
-}
-
-bool grid_is_consistent(grid_t *grid)
-{
-  return subgrid_apply(grid, subgrid_consistency);
-}
-
-status_t grid_heuristics(grid_t *grid)
-{
-  size_t size = grid->size;
-  colors_t *subgrid[size];
-  bool changed = true;
 
-  while (changed)
+  for (size_t unit = 0; unit < units_count; unit++)
   {
-    changed = false;
+    queued[unit] = false;
+    worklist_push(&worklist, unit);
+  }
 
-    /* ============================== Rows ============================== */
-    for (size_t row = 0; row < size; row++)
+  while (true)
+  {
+    while (worklist.length != 0)
     {
-      for (size_t column = 0; column < size; column++)
+      size_t unit = worklist_pop(&worklist);
+      const cell_index_t *cells = units_unit(grid->units, unit);
+
+      /* Every unit is checked once after its last change, which replaces the
+         consistency check of the whole grid after each sweep */
+      if (!subgrid_consistency(grid->cells, cells, size))
       {
-        subgrid[column] = &grid->cells[row][column];
+        if (fished)
+        {
+          search->fish_decided++;
+        }
+        return grid_inconsistent;
       }
-      changed = (subgrid_heuristics(subgrid, size) || changed);
-    }
 
-    /* ============================= Columns ============================= */
-    for (size_t column = 0; column < size; column++)
-    {
-      for (size_t row = 0; row < size; row++)
+      for (size_t i = 0; i < size; i++)
       {
-        subgrid[row] = &grid->cells[row][column];
+        before[i] = grid->cells[cells[i]];
       }
-      changed = (subgrid_heuristics(subgrid, size) || changed);
-    }
 
-    /* ============================= Blocks ============================= */
-    size_t sqr = sqrt(size);
-    size_t block_row = 0;
-    size_t block_column = 0;
-    for (size_t block = 0; block < size; block++)
-    {
-      for (size_t i = 0; i < sqr; i++)
+      /* Cross-hatching comes first, the other rules expect the colors of
+         the singletons to be isolated */
+      if (subgrid_crosshatching(grid->cells, cells, size))
+      {
+        grid_unit_changed(grid, cells, before, &worklist);
+        continue;
+      }
+
+      for (size_t i = 0; i < unit_count; i++)
       {
-        for (size_t j = 0; j < sqr; j++)
+        rule_t rule = unit_pipeline[i];
+        bool timed =
+            stats[rule] != NULL && stats[rule]->calls % TIMING_SAMPLE == 0;
+        double start = timed ? grid_clock() : 0;
+        bool changed = unit_rules[rule](grid->cells, cells, size);
+        size_t removed =
+            changed ? grid_unit_changed(grid, cells, before, &worklist) : 0;
+
+        if (stats[rule] != NULL)
+        {
+          stats[rule]->calls++;
+          stats[rule]->removed += removed;
+          if (timed)
+          {
+            stats[rule]->seconds += (grid_clock() - start) * TIMING_SAMPLE;
+          }
+        }
+
+        if (changed)
         {
-          subgrid[sqr * i + j] = &grid->cells[block_row + i][block_column + j];
+          break;
         }
       }
-      changed = (subgrid_heuristics(subgrid, size) || changed);
-      if (block_column < size - sqr)
+    }
+
+    /* The unit rules have reached their fixpoint: the grid rules are tried
+       in turn, and the unit rules are applied again as soon as one of them
+       removes a candidate */
+    for (size_t i = 0; i < grid_count && worklist.length == 0; i++)
+    {
+      rule_t rule = grid_pipeline[i];
+      double start = (stats[rule] != NULL) ? grid_clock() : 0;
+      size_t removed = 0;
+
+      switch (rule)
       {
-        block_column += sqr;
+        case rule_intersections:
+          removed = grid_intersections(grid, &worklist);
+          break;
+
+        case rule_fish:
+          removed = grid_fish(grid, search->fish_order, &worklist);
+          fished |= (removed != 0);
+          break;
+
+        case rule_alldiff:
+          removed = grid_alldiff(grid, &worklist);
+          break;
+
+        default:
+          break;
       }
-      else
+
+      if (stats[rule] != NULL)
       {
-        block_column = 0;
-        block_row += sqr;
+        stats[rule]->calls++;
+        stats[rule]->removed += removed;
+        stats[rule]->seconds += grid_clock() - start;
       }
     }
 
-    if (!grid_is_consistent(grid))
+    if (worklist.length == 0)
     {
-      return grid_inconsistent;
+      break;
     }
   }
 
   if (grid_is_solved(grid))
   {
+    if (fished)
+    {
+      search->fish_decided++;
+    }
     return grid_solved;
   }
 
   return grid_unsolved;
 }
 
-bool grid_choice_is_empty(const choice_t choice) { return (choice.color == 0); }
+bool grid_choice_is_empty(const choice_t choice)
+{
+  return colors_is_empty(choice.color);
+}
 
 void grid_choice_apply(grid_t *grid, const choice_t choice)
 {
-  grid->cells[choice.row][choice.column] = choice.color;
+  colors_t old = GRID_CELL(grid, choice.row, choice.column);
+  GRID_CELL(grid, choice.row, choice.column) = choice.color;
+  grid_cell_changed(grid, choice.row * grid->size + choice.column, old);
 }
 
 void grid_choice_discard(grid_t *grid, const choice_t choice)
 {
-  grid->cells[choice.row][choice.column] =
-      colors_subtract(grid->cells[choice.row][choice.column], choice.color);
+  colors_t old = GRID_CELL(grid, choice.row, choice.column);
+  GRID_CELL(grid, choice.row, choice.column) =
+      colors_subtract(old, choice.color);
+  grid_cell_changed(grid, choice.row * grid->size + choice.column, old);
 }
 
 void grid_choice_print(const choice_t choice, FILE *fd)
 {
   fprintf(fd, "row: %zu\ncolumn: %zu\n", choice.row, choice.column);
-  int i = 0;
+  size_t i = colors_rightmost_id(choice.color);
 
-  while (!colors_is_in(choice.color, i))
+  if (i < TABLE_COLORS)
   {
-    i++;
+    fprintf(fd, "choice: %c\n", color_table[i]);
+  }
+  else
+  {
+    fprintf(fd, "choice: %zu\n", i + 1);
   }
-
-  fprintf(fd, "choice: %c\n", color_table[i]);
 }
 
 choice_t grid_choice(grid_t *grid)
@@ -423,7 +1371,16 @@ choice_t grid_choice(grid_t *grid)
 
   if (grid_is_solved(grid))
   {
-    choice.color = 0;
+    choice.color = colors_empty();
+    return choice;
+  }
+
+  if (grid->buckets != NULL)
+  {
+    size_t cell = buckets_choice(grid);
+    choice.row = cell / grid->size;
+    choice.column = cell % grid->size;
+    choice.color = colors_rightmost(grid->cells[cell]);
     return choice;
   }
 
@@ -432,24 +1389,24 @@ choice_t grid_choice(grid_t *grid)
   {
     for (size_t column = 0; column < grid->size; column++)
     {
-      if (!colors_is_singleton(grid->cells[row][column]))
+      if (!colors_is_singleton(GRID_CELL(grid, row, column)))
       {
-        if (colors_count(grid->cells[row][column]) == 2)
+        if (colors_count(GRID_CELL(grid, row, column)) == 2)
         {
           choice.row = row;
           choice.column = column;
-          choice.color = colors_rightmost(grid->cells[row][column]);
+          choice.color = colors_rightmost(GRID_CELL(grid, row, column));
           return choice;
         }
 
         else
         {
-          if (colors_count(grid->cells[row][column]) < size_of_choice)
+          if (colors_count(GRID_CELL(grid, row, column)) < size_of_choice)
           {
-            size_of_choice = colors_count(grid->cells[row][column]);
+            size_of_choice = colors_count(GRID_CELL(grid, row, column));
             choice.row = row;
             choice.column = column;
-            choice.color = colors_rightmost(grid->cells[row][column]);
+            choice.color = colors_rightmost(GRID_CELL(grid, row, column));
           }
         }
       }
@@ -458,13 +1415,22 @@ choice_t grid_choice(grid_t *grid)
   return choice;
 }
 
-choice_t grid_choice_random(grid_t *grid)
+choice_t grid_choice_random(grid_t *grid, rng_t *rng)
 {
   choice_t choice;
 
   if (grid_is_solved(grid))
   {
-    choice.color = 0;
+    choice.color = colors_empty();
+    return choice;
+  }
+
+  if (grid->buckets != NULL)
+  {
+    size_t cell = buckets_choice(grid);
+    choice.row = cell / grid->size;
+    choice.column = cell % grid->size;
+    choice.color = colors_random(grid->cells[cell], rng);
     return choice;
   }
 
@@ -473,24 +1439,24 @@ choice_t grid_choice_random(grid_t *grid)
   {
     for (size_t column = 0; column < grid->size; column++)
     {
-      if (!colors_is_singleton(grid->cells[row][column]))
+      if (!colors_is_singleton(GRID_CELL(grid, row, column)))
       {
-        if (colors_count(grid->cells[row][column]) == 2)
+        if (colors_count(GRID_CELL(grid, row, column)) == 2)
         {
           choice.row = row;
           choice.column = column;
-          choice.color = colors_random(grid->cells[row][column]);
+          choice.color = colors_random(GRID_CELL(grid, row, column), rng);
           return choice;
         }
 
         else
         {
-          if (colors_count(grid->cells[row][column]) < size_of_choice)
+          if (colors_count(GRID_CELL(grid, row, column)) < size_of_choice)
           {
-            size_of_choice = colors_count(grid->cells[row][column]);
+            size_of_choice = colors_count(GRID_CELL(grid, row, column));
             choice.row = row;
             choice.column = column;
-            choice.color = colors_random(grid->cells[row][column]);
+            choice.color = colors_random(GRID_CELL(grid, row, column), rng);
           }
         }
       }
@@ -499,97 +1465,324 @@ choice_t grid_choice_random(grid_t *grid)
   return choice;
 }
 
-void backtrack_first(grid_t *grid, bool *solution_found, bool random)
+/* Growth of the budget of the geometric restarts */
+#define RESTART_FACTOR 1.5
+
+size_t luby(size_t index)
 {
-  choice_t choice;
+  size_t size = 1;
+  size_t sequence = 0;
+  while (size < index + 1)
+  {
+    sequence++;
+    size = 2 * size + 1;
+  }
+  while (size - 1 != index)
+  {
+    size = (size - 1) >> 1;
+    sequence--;
+    index = index % size;
+  }
+  return (size_t)1 << sequence;
+}
 
-  status_t result = grid_heuristics(grid);
+/* Returns the budget of dead ends of run 'index' (from 0) of a search with
+   restarts */
+static size_t restart_budget(const search_t *search, const size_t index)
+{
+  size_t base =
+      (search->restart_base != 0) ? search->restart_base : RESTART_BASE;
 
-  if (result == grid_inconsistent)
+  if (search->restart_policy == restart_luby)
   {
-    return;
+    return base * luby(index);
   }
 
-  if (result == grid_solved)
+  double budget = base;
+  for (size_t i = 0; i < index; i++)
   {
-    *solution_found = true;
-    return;
+    budget *= RESTART_FACTOR;
   }
+  return (size_t)budget;
+}
+
+/* Frame of the decision stack: a choice applied to the grid and the trail
+   position to come back to before trying its discard branch. In a parallel
+   search, the discard branch may have been given to another worker, and the
+   length of the path is kept to come back to the choice. */
+typedef struct
+{
+  choice_t choice;
+  size_t mark;
+  size_t path_length;
+  bool donated;
+} decision_t;
+
+/* Branches taken from the root of a parallel search: 0 for the apply branch
+   of a choice, 1 for its discard branch. Sorting solutions by path gives the
+   order of a sequential search. */
+typedef struct
+{
+  unsigned char *bits;
+  size_t length;
+  size_t capacity;
+} path_t;
 
-  if (random)
+static void path_push(path_t *path, const unsigned char bit)
+{
+  if (path->length == path->capacity)
   {
-    choice = grid_choice_random(grid);
+    size_t capacity = (path->capacity == 0) ? 64 : 2 * path->capacity;
+    unsigned char *bits = realloc(path->bits, capacity);
+    if (bits == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the path of a search");
+    }
+    path->bits = bits;
+    path->capacity = capacity;
   }
+  path->bits[path->length++] = bit;
+}
 
-  else
+/* Iterative search shared by all modes: the apply branch of a choice is
+   explored first, and its discard branch when the apply branch is done.
+   Instead of two recursive calls per choice, the pending choices are kept
+   in a decision stack allocated once, which can hold one choice per cell
+   (each applied choice turns an unsolved cell into a singleton).
+   Returns when the search space is exhausted, or after the first solution
+   in mode_first, or after the second one in mode_unique.
+   A random search in mode_first may also give up its run after a budget of
+   dead ends, and start again from the root with other choices: a run stuck
+   in a bad subtree does not have to exhaust it. The budget keeps growing, so
+   that a grid without solution is still proven so. */
+void grid_search(grid_t *grid, const mode_t mode, search_t *search,
+                 uint64_t *solution_count, FILE *output, worker_t *worker)
+{
+  if (!grid_trail_enable(grid))
   {
-    choice = grid_choice(grid);
+    err(EXIT_FAILURE, "Error: Impossible to alloc the trail of a grid");
   }
 
-  grid_t *copy = grid_copy(grid);
-  if (copy == NULL)
+  /* A task of a parallel search starts below the root */
+  size_t base = (worker != NULL) ? parallel_depth(worker) : 0;
+  size_t capacity = grid->size * grid->size;
+  if (search->max_depth != 0 && search->max_depth < capacity)
   {
-    return;
+    capacity = search->max_depth;
   }
-  grid_choice_apply(grid, choice);
-  backtrack_first(grid, solution_found, random);
+  capacity -= base;
 
-  if (*solution_found)
+  decision_t *stack = malloc(capacity * sizeof(decision_t));
+  if (stack == NULL)
   {
-    grid_free(copy);
-    return;
+    err(EXIT_FAILURE, "Error: Impossible to alloc the decision stack");
+  }
+  size_t depth = 0;
+  path_t path = {.bits = NULL, .length = 0, .capacity = 0};
+  buckets_build(grid, search->tie_break);
+
+  bool restarts = search->random && mode == mode_first &&
+                  search->restart_policy != restart_none;
+  size_t root = grid_trail_mark(grid);
+  size_t runs = 0;
+  size_t dead_ends = 0;
+  size_t budget = restarts ? restart_budget(search, 0) : 0;
+
+  while (true)
+  {
+    if (worker != NULL && parallel_stopped(worker))
+    {
+      break;
+    }
+
+    search->nodes++;
+    search->level = base + depth;
+    status_t result = grid_heuristics(grid, search);
+
+    if (result == grid_solved)
+    {
+      if (worker != NULL)
+      {
+        if (parallel_solution(worker, grid, path.bits, path.length))
+        {
+          break;
+        }
+      }
+
+      else
+      {
+        (*solution_count)++;
+
+        if (mode == mode_first ||
+            (mode == mode_unique && *solution_count == 2))
+        {
+          break;
+        }
+
+        if (mode == mode_all &&
+            grid_solution_found(grid, search, *solution_count, output))
+        {
+          break;
+        }
+      }
+    }
+
+    else if (result == grid_unsolved)
+    {
+      if (depth < capacity)
+      {
+        choice_t choice =
+            search->random ? grid_choice_random(grid, search->rng)
+                           : grid_choice(grid);
+        stack[depth].choice = choice;
+        stack[depth].mark = grid_trail_mark(grid);
+        stack[depth].path_length = path.length;
+        stack[depth].donated = false;
+
+        /* Idle workers are fed with the discard branch, as a copy of the
+           grid: this worker will not come back to it */
+        if (worker != NULL && parallel_hungry(worker))
+        {
+          grid_t *branch = grid_copy(grid);
+          if (branch == NULL)
+          {
+            err(EXIT_FAILURE, "Error: Impossible to alloc a branch");
+          }
+          grid_choice_discard(branch, choice);
+          path_push(&path, 1);
+          parallel_donate(worker, branch, base + depth, path.bits,
+                          path.length);
+          path.length--;
+          stack[depth].donated = true;
+        }
+
+        if (worker != NULL)
+        {
+          path_push(&path, 0);
+        }
+
+        depth++;
+        if (base + depth > search->depth)
+        {
+          search->depth = base + depth;
+        }
+        grid_choice_apply(grid, choice);
+        continue;
+      }
+
+      search->cut = true; /* too deep, this branch is given up */
+    }
+
+    else if (restarts && ++dead_ends == budget)
+    {
+      grid_trail_undo(grid, root);
+      depth = 0;
+      path.length = 0;
+      dead_ends = 0;
+      budget = restart_budget(search, ++runs);
+      search->restarts++;
+      continue;
+    }
+
+    /* Dead end, or solution already counted: let's go back to the last
+       choice and take its discard branch */
+    while (depth != 0 && stack[depth - 1].donated)
+    {
+      depth--;
+    }
+    if (depth == 0)
+    {
+      break;
+    }
+    depth--;
+    grid_trail_undo(grid, stack[depth].mark);
+    grid_choice_discard(grid, stack[depth].choice);
+    if (worker != NULL)
+    {
+      path.length = stack[depth].path_length;
+      path_push(&path, 1);
+    }
   }
 
-  copy->cells[choice.row][choice.column] =
-      colors_subtract(copy->cells[choice.row][choice.column], choice.color);
-  grid_copy2(copy, grid);
-  grid_free(copy);
-  backtrack_first(grid, solution_found, random);
+  /* The grid keeps the outcome of the search, and can be searched again
+     without its trail growing */
+  grid->trail_top = root;
+  buckets_free(grid);
+  free(stack);
+  free(path.bits);
 }
 
-void backtrack_all(grid_t *grid, int *solution_count, FILE *output)
+void backtrack_first(grid_t *grid, bool *solution_found, rng_t *rng)
 {
-  status_t result = grid_heuristics(grid);
+  search_t search = {.random = (rng != NULL), .rng = rng};
+  uint64_t solution_count = 0;
+  grid_search(grid, mode_first, &search, &solution_count, NULL, NULL);
+  *solution_found = (solution_count != 0);
+}
+
+void backtrack_all(grid_t *grid, uint64_t *solution_count, FILE *output)
+{
+  search_t search = {.random = false};
+  grid_search(grid, mode_all, &search, solution_count, output, NULL);
+}
 
-  if (result == grid_inconsistent)
+/* Runs the search engine chosen in the options of a search */
+static void engine_search(grid_t *grid, const mode_t mode, search_t *search,
+                          uint64_t *solution_count, FILE *output)
+{
+  if (search->engine == engine_dlx)
   {
-    return;
+    dlx_search(grid, mode, search, solution_count, output);
   }
-
-  if (result == grid_solved)
+  else if (search->engine == engine_cdcl)
   {
-    (*solution_count)++;
-    fprintf(output, "Solution %d:\n", *solution_count);
-    grid_print(grid, output);
-    return;
+    cdcl_search(grid, mode, search, solution_count, output);
   }
-
-  choice_t choice = grid_choice(grid);
-  grid_t *copy = grid_copy(grid);
-  if (copy == NULL)
+  else if (search->portfolio > 1 && mode == mode_first)
   {
-    return;
+    portfolio_search(grid, search, solution_count);
+  }
+  else if (search->threads > 1)
+  {
+    parallel_search(grid, mode, search, solution_count, output);
+  }
+  else
+  {
+    grid_search(grid, mode, search, solution_count, output, NULL);
   }
-  grid_choice_apply(grid, choice);
-  backtrack_all(grid, solution_count, output);
+}
 
-  copy->cells[choice.row][choice.column] =
-      colors_subtract(copy->cells[choice.row][choice.column], choice.color);
-  grid_copy2(copy, grid);
-  grid_free(copy);
+/* Writes the header of the packed solutions of a grid */
+static void packed_header(const grid_t *grid, FILE *fd)
+{
+  unsigned char header[PACKED_HEADER] = {'S', 'D', 'K', 'P', PACKED_VERSION,
+                                         grid->size, packed_bits(grid->size),
+                                         0};
+  fwrite(header, 1, PACKED_HEADER, fd);
+}
 
-  backtrack_all(grid, solution_count, output);
+/* Writes the end of the packed solutions of a grid, with their number */
+static void packed_end(uint64_t solution_count, FILE *fd)
+{
+  unsigned char end[9] = {'E'};
+  for (size_t i = 1; i < 9; i++)
+  {
+    end[i] = solution_count & 0xff;
+    solution_count >>= 8;
+  }
+  fwrite(end, 1, sizeof(end), fd);
 }
 
-grid_t *grid_solver(grid_t *grid, mode_t mode, bool *error, FILE *output,
-                    bool random)
+grid_t *grid_solver(grid_t *grid, const mode_t mode, bool *error,
+                    FILE *output, search_t *search)
 {
+  uint64_t solution_count = 0;
+
   if (mode == mode_first)
   {
-    bool solution_found = false;
-    backtrack_first(grid, &solution_found, random);
+    engine_search(grid, mode_first, search, &solution_count, NULL);
 
-    if (grid_is_solved(grid))
+    if (solution_count != 0)
     {
       return grid;
     }
@@ -601,61 +1794,43 @@ grid_t *grid_solver(grid_t *grid, mode_t mode, bool *error, FILE *output,
     }
   }
 
-  int solution_count = 0;
-  backtrack_all(grid, &solution_count, output);
-  fprintf(output, "%d solution(s) found\n", solution_count);
-
-  if (solution_count == 0)
+  if (grid->packed)
   {
-    *error = true;
+    packed_header(grid, output);
   }
 
-  return NULL;
-}
-
-/* =========== All these last functions are for grid generation =========== */
-
-void backtrack_unique_solution(grid_t *grid, int *solution_count)
-{
-  status_t result = grid_heuristics(grid);
+  engine_search(grid, mode_all, search, &solution_count, output);
 
-  if (result == grid_inconsistent)
+  if (grid->packed)
   {
-    return;
+    packed_end(solution_count, output);
   }
-
-  if (result == grid_solved)
+  else
   {
-    (*solution_count)++;
-    return;
+    fprintf(output, grid->line ? "# %" PRIu64 " solution(s) found\n"
+                               : "%" PRIu64 " solution(s) found\n",
+            solution_count);
   }
 
-  choice_t choice = grid_choice(grid);
-  grid_t *copy = grid_copy(grid);
-  if (copy == NULL)
+  if (solution_count == 0)
   {
-    return;
+    *error = true;
   }
-  grid_choice_apply(grid, choice);
-  backtrack_unique_solution(grid, solution_count);
 
-  if (*solution_count == 2)
-  {
-    grid_free(copy);
-    return;
-  }
+  return NULL;
+}
 
-  copy->cells[choice.row][choice.column] =
-      colors_subtract(copy->cells[choice.row][choice.column], choice.color);
-  grid_copy2(copy, grid);
-  grid_free(copy);
+/* =========== All these last functions are for grid generation =========== */
 
-  backtrack_unique_solution(grid, solution_count);
+void backtrack_unique_solution(grid_t *grid, uint64_t *solution_count)
+{
+  search_t search = {.random = false};
+  dlx_search(grid, mode_unique, &search, solution_count, NULL);
 }
 
 bool solution_is_unique(grid_t *grid)
 {
-  int solution_count = 0;
+  uint64_t solution_count = 0;
   backtrack_unique_solution(grid, &solution_count);
   if (solution_count == 2)
   {
@@ -664,7 +1839,7 @@ bool solution_is_unique(grid_t *grid)
   return true;
 }
 
-grid_t *grid_generation(int size, bool unique)
+grid_t *grid_generation(int size, bool unique, rng_t *rng)
 {
   float ratio = size * size / RATIO;
   int hidden_cases = 0;
@@ -680,11 +1855,12 @@ grid_t *grid_generation(int size, bool unique)
   {
     for (size_t column = 0; column < size_2; column++)
     {
-      grid->cells[row][column] = colors_full(size_2);
+      GRID_CELL(grid, row, column) = colors_full(size_2);
     }
   }
 
-  grid_solver(grid, mode_first, NULL, NULL, true);
+  search_t search = {.random = true, .rng = rng};
+  grid_solver(grid, mode_first, NULL, NULL, &search);
 
   while (hidden_cases <= ratio)
   {
@@ -692,12 +1868,13 @@ grid_t *grid_generation(int size, bool unique)
     {
       for (size_t column = 0; column < size_2; column++)
       {
-        if (colors_random(fill_rate) == 1)
+        if (colors_is_equal(colors_random(fill_rate, rng), colors_set(0)))
         {
-          if (grid->cells[row][column] != colors_full(size_2))
+          if (!colors_is_equal(GRID_CELL(grid, row, column),
+                               colors_full(size_2)))
           {
             hidden_cases++;
-            grid->cells[row][column] = colors_full(size_2);
+            GRID_CELL(grid, row, column) = colors_full(size_2);
             if (hidden_cases > ratio)
             {
               goto hidden_enough;
@@ -722,7 +1899,7 @@ hidden_enough:
     {
       grid_free(copy);
       grid_free(grid);
-      return grid_generation(size, unique);
+      return grid_generation(size, unique, rng);
     }
 
     grid_free(copy);
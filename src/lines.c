@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L /* posix_madvise() */
+
+#include "lines.h"
+
+#include <stdlib.h>
+#include <string.h> /* memchr(), memmove() */
+#include <unistd.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Bytes read at once from the standard input or a pipe, the buffer growing
+   for longer lines */
+#define LINES_BUFFER (1 << 20)
+
+bool lines_open(lines_t *lines, const char *file_name)
+{
+  *lines = (lines_t){.file_name = file_name, .fd = STDIN_FILENO};
+
+  if (strcmp(file_name, "-") != 0)
+  {
+    lines->fd = open(file_name, O_RDONLY);
+    if (lines->fd < 0)
+    {
+      warn("Error on file %s", file_name);
+      return false;
+    }
+  }
+
+  struct stat status;
+  if (fstat(lines->fd, &status) == 0 && S_ISREG(status.st_mode) &&
+      status.st_size > 0)
+  {
+    void *map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, lines->fd,
+                     0);
+    if (map != MAP_FAILED)
+    {
+      posix_madvise(map, status.st_size, POSIX_MADV_SEQUENTIAL);
+      lines->data = map;
+      lines->length = status.st_size;
+      lines->eof = true;
+      return true;
+    }
+  }
+
+  lines->capacity = LINES_BUFFER;
+  lines->data = malloc(lines->capacity);
+  if (lines->data == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the buffer of %s",
+        file_name);
+  }
+  return true;
+}
+
+bool lines_next(lines_t *lines, const char **line, size_t *length)
+{
+  while (true)
+  {
+    char *begin = lines->data + lines->start;
+    size_t left = lines->length - lines->start;
+    char *end = memchr(begin, '\n', left);
+
+    if (end != NULL || (lines->eof && left != 0))
+    {
+      *line = begin;
+      *length = (end != NULL) ? (size_t)(end - begin) : left;
+      lines->start += (end != NULL) ? *length + 1 : left;
+      return true;
+    }
+
+    if (lines->eof)
+    {
+      return false;
+    }
+
+    /* Keeps the beginning of the last line, and reads what follows */
+    memmove(lines->data, begin, left);
+    lines->length = left;
+    lines->start = 0;
+
+    if (lines->length == lines->capacity)
+    {
+      lines->capacity *= 2;
+      lines->data = realloc(lines->data, lines->capacity);
+      if (lines->data == NULL)
+      {
+        err(EXIT_FAILURE, "Error: Impossible to alloc the buffer of %s",
+            lines->file_name);
+      }
+    }
+
+    ssize_t count = read(lines->fd, lines->data + lines->length,
+                         lines->capacity - lines->length);
+    if (count > 0)
+    {
+      lines->length += count;
+    }
+    else if (count == 0 || errno != EINTR)
+    {
+      if (count < 0)
+      {
+        warn("Error on file %s", lines->file_name);
+        lines->error = true;
+      }
+      lines->eof = true;
+    }
+  }
+}
+
+void lines_close(lines_t *lines)
+{
+  if (lines->capacity == 0)
+  {
+    munmap(lines->data, lines->length);
+  }
+  else
+  {
+    free(lines->data);
+  }
+
+  if (lines->fd != STDIN_FILENO)
+  {
+    close(lines->fd);
+  }
+}
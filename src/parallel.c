@@ -0,0 +1,883 @@
+#define _POSIX_C_SOURCE 200809L /* nanosleep() */
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <err.h>
+
+/* Largest fish of the portfolio members which look for fish */
+#define PORTFOLIO_FISH_ORDER 3
+
+/* A thread waiting on a queue yields QUEUE_SPINS times, then sleeps
+   QUEUE_NAP nanoseconds between its tries */
+#define QUEUE_SPINS 64
+#define QUEUE_NAP 50000
+
+struct queue_cell
+{
+  atomic_size_t sequence; /* position of the cell in the ring when it can be
+                             filled, plus one when it can be emptied */
+  void *item;
+};
+
+/* Branch of the search tree waiting for a worker */
+typedef struct task task_t;
+
+struct task
+{
+  grid_t *grid;
+  size_t depth;        /* choices made above the branch */
+  unsigned char *path; /* branches taken from the root (see grid_search()) */
+  size_t length;
+  unsigned char *mark; /* path of the last solution found in the branch, no
+                          solution before it is still to be found (NULL:
+                          'path') */
+  size_t mark_length;
+  task_t *prev;        /* tasks not finished yet, when solutions are printed
+                          in order */
+  task_t *next;
+};
+
+/* Tasks given by a worker: it pushes and pops them at the bottom (its last
+   branches, still warm in its cache) and the other workers steal them at
+   the top (the oldest branches, nearer to the root, so the biggest ones) */
+typedef struct
+{
+  pthread_mutex_t lock;
+  task_t **tasks;
+  size_t top;
+  size_t bottom;
+  size_t capacity;
+} deque_t;
+
+/* Solution found in mode_all, waiting until the solutions before it are
+   printed */
+typedef struct
+{
+  grid_t *grid;
+  unsigned char *path;
+  size_t length;
+} solution_t;
+
+typedef struct pool pool_t;
+
+struct worker
+{
+  pool_t *pool;
+  size_t id;
+  pthread_t thread;
+  deque_t deque;
+  search_t search; /* options of the search, statistics of the worker */
+  rng_t rng;       /* stream of the worker in a random search */
+  task_t *task;    /* task being explored */
+};
+
+struct pool
+{
+  mode_t mode;
+  size_t threads;
+  worker_t *workers;
+  bool portfolio;        /* each worker runs its own search of the grid */
+  size_t winner;         /* worker which has stopped the search */
+  atomic_bool stop;      /* enough solutions have been found */
+  atomic_size_t pending; /* tasks created and not finished yet */
+  atomic_size_t queued;  /* tasks waiting in a deque */
+  atomic_size_t idle;    /* workers waiting for a task */
+  pthread_mutex_t lock;  /* protects the fields below and 'wake' */
+  pthread_cond_t wake;
+  grid_t *grid;          /* grid of the search, receives a solution */
+  uint64_t solution_count;
+  bool stream;           /* mode_all printing the solutions */
+  FILE *output;
+  uint64_t printed;      /* number of the last solution printed */
+  task_t *tasks;         /* tasks not finished yet, if 'stream' */
+  solution_t *solutions; /* min-heap of the solutions waiting to be printed */
+  size_t solutions_count;
+  size_t solutions_capacity;
+};
+
+/* Returns a copy of 'prefix' followed by 'path' */
+static unsigned char *path_join(const unsigned char prefix[],
+                                const size_t prefix_length,
+                                const unsigned char path[],
+                                const size_t length)
+{
+  unsigned char *joined = malloc(prefix_length + length + 1);
+  if (joined == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the path of a branch");
+  }
+  if (prefix_length != 0)
+  {
+    memcpy(joined, prefix, prefix_length);
+  }
+  if (length != 0)
+  {
+    memcpy(joined + prefix_length, path, length);
+  }
+  return joined;
+}
+
+static task_t *task_new(grid_t *grid, const size_t depth, unsigned char *path,
+                        const size_t length)
+{
+  task_t *task = malloc(sizeof(task_t));
+  if (task == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc a task");
+  }
+  task->grid = grid;
+  task->depth = depth;
+  task->path = path;
+  task->length = length;
+  task->mark = NULL;
+  task->mark_length = 0;
+  task->prev = NULL;
+  task->next = NULL;
+  return task;
+}
+
+static void task_free(task_t *task)
+{
+  grid_free(task->grid);
+  free(task->path);
+  free(task->mark);
+  free(task);
+}
+
+/* Orders paths as a sequential search explores them: apply branches (0)
+   come before discard branches (1), and a branch before its sub-branches */
+static int path_compare(const unsigned char first[], const size_t first_length,
+                        const unsigned char second[],
+                        const size_t second_length)
+{
+  size_t length = (first_length < second_length) ? first_length
+                                                 : second_length;
+  int order = (length != 0) ? memcmp(first, second, length) : 0;
+  if (order != 0)
+  {
+    return order;
+  }
+  return (first_length > second_length) - (first_length < second_length);
+}
+
+/* Orders the marks of two tasks */
+static int mark_compare(const task_t *first, const task_t *second)
+{
+  return path_compare(
+      (first->mark != NULL) ? first->mark : first->path,
+      (first->mark != NULL) ? first->mark_length : first->length,
+      (second->mark != NULL) ? second->mark : second->path,
+      (second->mark != NULL) ? second->mark_length : second->length);
+}
+
+/* Orders a solution and the mark of a task */
+static int solution_mark_compare(const solution_t *solution,
+                                 const task_t *task)
+{
+  return path_compare(solution->path, solution->length,
+                      (task->mark != NULL) ? task->mark : task->path,
+                      (task->mark != NULL) ? task->mark_length : task->length);
+}
+
+static int solution_compare(const solution_t *first, const solution_t *second)
+{
+  return path_compare(first->path, first->length, second->path,
+                      second->length);
+}
+
+static void deque_init(deque_t *deque)
+{
+  pthread_mutex_init(&deque->lock, NULL);
+  deque->tasks = NULL;
+  deque->top = 0;
+  deque->bottom = 0;
+  deque->capacity = 0;
+}
+
+static void deque_push(deque_t *deque, task_t *task)
+{
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom == deque->capacity)
+  {
+    size_t capacity = (deque->capacity == 0) ? 16 : 2 * deque->capacity;
+    task_t **tasks = realloc(deque->tasks, capacity * sizeof(task_t *));
+    if (tasks == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the tasks of a worker");
+    }
+    deque->tasks = tasks;
+    deque->capacity = capacity;
+  }
+  deque->tasks[deque->bottom++] = task;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+/* Takes the task at the bottom (owner) or at the top (thief) of a deque,
+   returns NULL if it is empty */
+static task_t *deque_take(deque_t *deque, const bool steal)
+{
+  task_t *task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->top != deque->bottom)
+  {
+    task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+    if (deque->top == deque->bottom)
+    {
+      deque->top = 0;
+      deque->bottom = 0;
+    }
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+static void deque_destroy(deque_t *deque)
+{
+  task_t *task;
+  while ((task = deque_take(deque, false)) != NULL)
+  {
+    task_free(task);
+  }
+  free(deque->tasks);
+  pthread_mutex_destroy(&deque->lock);
+}
+
+/* Adds a solution to the heap of the solutions waiting to be printed */
+static void solutions_push(pool_t *pool, const solution_t solution)
+{
+  if (pool->solutions_count == pool->solutions_capacity)
+  {
+    size_t capacity =
+        (pool->solutions_capacity == 0) ? 16 : 2 * pool->solutions_capacity;
+    solution_t *solutions =
+        realloc(pool->solutions, capacity * sizeof(solution_t));
+    if (solutions == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to grow the solutions");
+    }
+    pool->solutions = solutions;
+    pool->solutions_capacity = capacity;
+  }
+
+  size_t i = pool->solutions_count++;
+  while (i != 0 &&
+         solution_compare(&solution, &pool->solutions[(i - 1) / 2]) < 0)
+  {
+    pool->solutions[i] = pool->solutions[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  pool->solutions[i] = solution;
+}
+
+/* Removes the first solution of the heap */
+static solution_t solutions_pop(pool_t *pool)
+{
+  solution_t first = pool->solutions[0];
+  solution_t last = pool->solutions[--pool->solutions_count];
+  size_t i = 0;
+
+  while (2 * i + 1 < pool->solutions_count)
+  {
+    size_t child = 2 * i + 1;
+    if (child + 1 < pool->solutions_count &&
+        solution_compare(&pool->solutions[child + 1],
+                         &pool->solutions[child]) < 0)
+    {
+      child++;
+    }
+    if (solution_compare(&last, &pool->solutions[child]) <= 0)
+    {
+      break;
+    }
+    pool->solutions[i] = pool->solutions[child];
+    i = child;
+  }
+  pool->solutions[i] = last;
+  return first;
+}
+
+/* Prints the waiting solutions which come before all the solutions still to
+   be found: those of the tasks not finished yet come after their mark. With
+   'all', prints all of them (the search is over). Called with the lock of
+   the pool. */
+static void pool_print(pool_t *pool, const bool all)
+{
+  const task_t *first = NULL;
+  for (const task_t *task = pool->tasks; !all && task != NULL;
+       task = task->next)
+  {
+    if (first == NULL || mark_compare(task, first) < 0)
+    {
+      first = task;
+    }
+  }
+
+  while (pool->solutions_count != 0 &&
+         (all || first == NULL ||
+          solution_mark_compare(&pool->solutions[0], first) <= 0))
+  {
+    solution_t solution = solutions_pop(pool);
+    grid_print_solution(solution.grid, ++pool->printed, pool->output);
+    grid_free(solution.grid);
+    free(solution.path);
+  }
+}
+
+/* Records a task as not finished, before a worker can take it */
+static void pool_task_add(pool_t *pool, task_t *task)
+{
+  if (!pool->stream)
+  {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  task->next = pool->tasks;
+  if (pool->tasks != NULL)
+  {
+    pool->tasks->prev = task;
+  }
+  pool->tasks = task;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Records a task as finished, which may let the solutions waiting for it be
+   printed */
+static void pool_task_done(pool_t *pool, task_t *task)
+{
+  if (!pool->stream)
+  {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  if (task->prev != NULL)
+  {
+    task->prev->next = task->next;
+  }
+  else
+  {
+    pool->tasks = task->next;
+  }
+  if (task->next != NULL)
+  {
+    task->next->prev = task->prev;
+  }
+  pool_print(pool, false);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Wakes up the workers waiting for a task or for the end of the search */
+static void pool_wake(pool_t *pool, const bool all)
+{
+  pthread_mutex_lock(&pool->lock);
+  if (all)
+  {
+    pthread_cond_broadcast(&pool->wake);
+  }
+  else
+  {
+    pthread_cond_signal(&pool->wake);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Returns a task of the worker, or one stolen from another worker, or NULL
+   if all the deques are empty */
+static task_t *worker_next(worker_t *worker)
+{
+  pool_t *pool = worker->pool;
+  task_t *task = deque_take(&worker->deque, false);
+
+  for (size_t i = 1; task == NULL && !pool->portfolio && i < pool->threads;
+       i++)
+  {
+    task = deque_take(&pool->workers[(worker->id + i) % pool->threads].deque,
+                      true);
+  }
+
+  if (task != NULL)
+  {
+    atomic_fetch_sub(&pool->queued, 1);
+  }
+  return task;
+}
+
+static void *worker_run(void *arg)
+{
+  worker_t *worker = arg;
+  pool_t *pool = worker->pool;
+
+  while (true)
+  {
+    task_t *task = worker_next(worker);
+
+    if (task == NULL && pool->portfolio)
+    {
+      break; /* the search of the worker is over */
+    }
+
+    if (task == NULL)
+    {
+      /* A task is given only while some workers are idle, so the worker
+         waits here until then, or until the last task is finished */
+      pthread_mutex_lock(&pool->lock);
+      atomic_fetch_add(&pool->idle, 1);
+      while (!atomic_load(&pool->stop) && atomic_load(&pool->pending) != 0 &&
+             atomic_load(&pool->queued) == 0)
+      {
+        pthread_cond_wait(&pool->wake, &pool->lock);
+      }
+      atomic_fetch_sub(&pool->idle, 1);
+      bool done = atomic_load(&pool->stop) || atomic_load(&pool->pending) == 0;
+      pthread_mutex_unlock(&pool->lock);
+
+      if (done)
+      {
+        break;
+      }
+      continue;
+    }
+
+    if (!atomic_load(&pool->stop))
+    {
+      uint64_t solution_count = 0;
+      worker->task = task;
+      grid_search(task->grid, pool->mode, &worker->search, &solution_count,
+                  NULL, worker);
+      worker->task = NULL;
+    }
+    pool_task_done(pool, task);
+    task_free(task);
+
+    if (atomic_fetch_sub(&pool->pending, 1) == 1)
+    {
+      pool_wake(pool, true);
+    }
+  }
+
+  return NULL;
+}
+
+bool parallel_stopped(const worker_t *worker)
+{
+  return atomic_load_explicit(&worker->pool->stop, memory_order_relaxed);
+}
+
+size_t parallel_depth(const worker_t *worker) { return worker->task->depth; }
+
+bool parallel_hungry(const worker_t *worker)
+{
+  pool_t *pool = worker->pool;
+  return !pool->portfolio &&
+         atomic_load_explicit(&pool->idle, memory_order_relaxed) >
+             atomic_load_explicit(&pool->queued, memory_order_relaxed);
+}
+
+void parallel_donate(worker_t *worker, grid_t *branch, const size_t depth,
+                     const unsigned char path[], const size_t length)
+{
+  pool_t *pool = worker->pool;
+  task_t *task = worker->task;
+  task_t *donated =
+      task_new(branch, depth, path_join(task->path, task->length, path, length),
+               task->length + length);
+
+  atomic_fetch_add(&pool->pending, 1);
+  pool_task_add(pool, donated);
+  deque_push(&worker->deque, donated);
+  atomic_fetch_add(&pool->queued, 1);
+  pool_wake(pool, false);
+}
+
+bool parallel_solution(worker_t *worker, const grid_t *grid,
+                       const unsigned char path[], const size_t length)
+{
+  pool_t *pool = worker->pool;
+  bool stop = false;
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (atomic_load(&pool->stop))
+  {
+    stop = true;
+  }
+
+  else if (pool->mode == mode_all)
+  {
+    if (pool->stream)
+    {
+      /* The next solutions of the task come after this one */
+      task_t *task = worker->task;
+      solution_t solution;
+      solution.grid = grid_copy(grid);
+      if (solution.grid == NULL)
+      {
+        err(EXIT_FAILURE, "Error: Impossible to alloc a solution");
+      }
+      solution.length = task->length + length;
+      solution.path = path_join(task->path, task->length, path, length);
+      free(task->mark);
+      task->mark = path_join(solution.path, solution.length, NULL, 0);
+      task->mark_length = solution.length;
+      solutions_push(pool, solution);
+      pool_print(pool, false);
+    }
+    pool->solution_count++;
+
+    if (worker->search.max_solutions != 0 &&
+        pool->solution_count >= worker->search.max_solutions)
+    {
+      atomic_store(&pool->stop, true);
+      pthread_cond_broadcast(&pool->wake);
+      stop = true;
+    }
+  }
+
+  else
+  {
+    pool->solution_count++;
+    grid_copy2(grid, pool->grid);
+    if (pool->mode == mode_first || pool->solution_count == 2)
+    {
+      pool->winner = worker->id;
+      atomic_store(&pool->stop, true);
+      pthread_cond_broadcast(&pool->wake);
+      stop = true;
+    }
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return stop;
+}
+
+/* Adds the statistics of a worker to the ones of the search */
+static void search_merge(search_t *search, const search_t *worker)
+{
+  search->nodes += worker->nodes;
+  if (worker->depth > search->depth)
+  {
+    search->depth = worker->depth;
+  }
+  search->cut |= worker->cut;
+  search->fish_decided += worker->fish_decided;
+
+  for (size_t rule = 0; rule < RULES_COUNT; rule++)
+  {
+    for (size_t band = 0; band < RULE_BANDS; band++)
+    {
+      rule_stats_t *stats = &search->rules_stats[rule][band];
+      const rule_stats_t *worker_stats = &worker->rules_stats[rule][band];
+      stats->calls += worker_stats->calls;
+      stats->removed += worker_stats->removed;
+      stats->seconds += worker_stats->seconds;
+      stats->skipped += worker_stats->skipped;
+    }
+  }
+}
+
+
+/* Prepares a pool of 'threads' workers, each one with the options of
+   'search', its own statistics and its own random stream */
+static void pool_init(pool_t *pool, grid_t *grid, const mode_t mode,
+                      const search_t *search, const size_t threads)
+{
+  pool->mode = mode;
+  pool->threads = threads;
+  pool->portfolio = false;
+  pool->winner = 0;
+  pool->grid = grid;
+  pool->solution_count = 0;
+  pool->stream = false;
+  pool->output = NULL;
+  pool->printed = 0;
+  pool->tasks = NULL;
+  pool->solutions = NULL;
+  pool->solutions_count = 0;
+  pool->solutions_capacity = 0;
+  atomic_init(&pool->stop, false);
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->queued, 0);
+  atomic_init(&pool->idle, 0);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+
+  pool->workers = calloc(threads, sizeof(worker_t));
+  if (pool->workers == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the workers of a search");
+  }
+
+  for (size_t i = 0; i < threads; i++)
+  {
+    worker_t *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->id = i;
+    worker->task = NULL;
+    deque_init(&worker->deque);
+
+    worker->search = *search;
+    worker->search.nodes = 0;
+    worker->search.depth = 0;
+    worker->search.cut = false;
+    worker->search.fish_decided = 0;
+    memset(worker->search.rules_stats, 0, sizeof(search->rules_stats));
+    if (search->rng != NULL)
+    {
+      rng_split(search->rng, &worker->rng);
+      worker->search.rng = &worker->rng;
+    }
+  }
+}
+
+/* Gives a copy of the grid of the pool to a worker */
+static void pool_give_root(pool_t *pool, const size_t worker)
+{
+  grid_t *root = grid_copy(pool->grid);
+  if (root == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the grid of a worker");
+  }
+  task_t *task = task_new(root, 0, NULL, 0);
+  atomic_fetch_add(&pool->pending, 1);
+  atomic_fetch_add(&pool->queued, 1);
+  pool_task_add(pool, task);
+  deque_push(&pool->workers[worker].deque, task);
+}
+
+/* Runs the workers until the end of the search, and gathers their
+   statistics in 'search' */
+static void pool_run(pool_t *pool, search_t *search)
+{
+  for (size_t i = 0; i < pool->threads; i++)
+  {
+    if (pthread_create(&pool->workers[i].thread, NULL, worker_run,
+                       &pool->workers[i]) != 0)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to start a worker thread");
+    }
+  }
+
+  for (size_t i = 0; i < pool->threads; i++)
+  {
+    pthread_join(pool->workers[i].thread, NULL);
+    search_merge(search, &pool->workers[i].search);
+    deque_destroy(&pool->workers[i].deque);
+  }
+}
+
+static void pool_destroy(pool_t *pool)
+{
+  free(pool->solutions);
+  free(pool->workers);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+void parallel_search(grid_t *grid, const mode_t mode, search_t *search,
+                     uint64_t *solution_count, FILE *output)
+{
+  pool_t pool;
+  pool_init(&pool, grid, mode, search, search->threads);
+  pool.stream = (mode == mode_all && !search->count_only);
+  pool.output = output;
+  pool.printed = *solution_count;
+  pool_give_root(&pool, 0);
+  pool_run(&pool, search);
+
+  /* Solutions still waiting when search->max_solutions stopped the search */
+  pool_print(&pool, true);
+
+  *solution_count += pool.solution_count;
+  pool_destroy(&pool);
+}
+
+void portfolio_config(search_t *config, const size_t member)
+{
+  static const choice_policy_t policies[] = {choice_position, choice_first,
+                                             choice_degree};
+
+  if (!config->rules_set)
+  {
+    grid_rules_default(config);
+  }
+
+  if (member == 0)
+  {
+    return; /* the search as it was asked */
+  }
+
+  config->random = true;
+  config->tie_break = policies[member % 3];
+  switch ((member / 3) % 3)
+  {
+    case 1:
+      grid_rules_add(config, rule_alldiff);
+      break;
+
+    case 2:
+      if (config->fish_order < 2)
+      {
+        config->fish_order = PORTFOLIO_FISH_ORDER;
+      }
+      grid_rules_add(config, rule_fish);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void portfolio_search(grid_t *grid, search_t *search, uint64_t *solution_count)
+{
+  pool_t pool;
+  pool_init(&pool, grid, mode_first, search, search->portfolio);
+  pool.portfolio = true;
+
+  for (size_t i = 0; i < pool.threads; i++)
+  {
+    portfolio_config(&pool.workers[i].search, i);
+    pool_give_root(&pool, i);
+  }
+  pool_run(&pool, search);
+
+  search->winner = pool.winner;
+  *solution_count += pool.solution_count;
+  pool_destroy(&pool);
+}
+
+bool queue_init(queue_t *queue, const size_t capacity)
+{
+  size_t size = 1;
+  while (size < capacity)
+  {
+    size *= 2;
+  }
+
+  queue->cells = malloc(size * sizeof(queue_cell_t));
+  if (queue->cells == NULL)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < size; i++)
+  {
+    atomic_init(&queue->cells[i].sequence, i);
+  }
+  queue->mask = size - 1;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  return true;
+}
+
+void queue_destroy(queue_t *queue) { free(queue->cells); }
+
+bool queue_try_push(queue_t *queue, void *item)
+{
+  size_t position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+  while (true)
+  {
+    queue_cell_t *cell = &queue->cells[position & queue->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+
+    if (lag == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &position,
+                                                position + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        cell->item = item;
+        atomic_store_explicit(&cell->sequence, position + 1,
+                              memory_order_release);
+        return true;
+      }
+    }
+    else if (lag < 0) /* the cell of the previous round is still full */
+    {
+      return false;
+    }
+    else /* another producer took the cell */
+    {
+      position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    }
+  }
+}
+
+bool queue_try_pop(queue_t *queue, void **item)
+{
+  size_t position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+  while (true)
+  {
+    queue_cell_t *cell = &queue->cells[position & queue->mask];
+    size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t lag = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if (lag == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &position,
+                                                position + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        *item = cell->item;
+        atomic_store_explicit(&cell->sequence, position + queue->mask + 1,
+                              memory_order_release);
+        return true;
+      }
+    }
+    else if (lag < 0) /* the cell has not been filled yet */
+    {
+      return false;
+    }
+    else /* another consumer took the cell */
+    {
+      position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+}
+
+/* Lets the other threads run while a queue is full or empty */
+static void queue_wait(size_t *tries)
+{
+  if (++*tries < QUEUE_SPINS)
+  {
+    sched_yield();
+  }
+  else
+  {
+    struct timespec nap = {.tv_sec = 0, .tv_nsec = QUEUE_NAP};
+    nanosleep(&nap, NULL);
+  }
+}
+
+void queue_push(queue_t *queue, void *item)
+{
+  size_t tries = 0;
+  while (!queue_try_push(queue, item))
+  {
+    queue_wait(&tries);
+  }
+}
+
+void *queue_pop(queue_t *queue)
+{
+  size_t tries = 0;
+  void *item;
+  while (!queue_try_pop(queue, &item))
+  {
+    queue_wait(&tries);
+  }
+  return item;
+}
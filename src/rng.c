@@ -0,0 +1,95 @@
+#include "rng.h"
+
+#include <unistd.h> /* getpid() */
+
+#include <time.h>
+
+/* Returns the next output of a splitmix64 generator, used to spread a seed
+   over the whole xoshiro256** state */
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static uint64_t rotl(const uint64_t x, const int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(rng_t *rng, const uint64_t seed)
+{
+  uint64_t x = seed;
+  for (size_t i = 0; i < 4; i++)
+  {
+    rng->s[i] = splitmix64(&x);
+  }
+}
+
+uint64_t rng_default_seed(void)
+{
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  uint64_t x = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^
+               ((uint64_t)getpid() << 16);
+  return splitmix64(&x);
+}
+
+uint64_t rng_next(rng_t *rng)
+{
+  uint64_t *s = rng->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+void rng_split(rng_t *rng, rng_t *stream)
+{
+  /* Jump polynomial of xoshiro256**, equivalent to 2^128 calls to next */
+  static const uint64_t jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                  0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+  uint64_t s[4] = {0, 0, 0, 0};
+
+  *stream = *rng;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    for (int b = 0; b < 64; b++)
+    {
+      if (jump[i] & (1ULL << b))
+      {
+        for (size_t j = 0; j < 4; j++)
+        {
+          s[j] ^= rng->s[j];
+        }
+      }
+      rng_next(rng);
+    }
+  }
+
+  for (size_t j = 0; j < 4; j++)
+  {
+    rng->s[j] = s[j];
+  }
+}
+
+size_t rng_below(rng_t *rng, const size_t bound)
+{
+#if defined(__SIZEOF_INT128__)
+  /* Multiply-shift instead of a modulo (Lemire): the bias is below
+     bound / 2^64, negligible for the small bounds used here */
+  return ((unsigned __int128)rng_next(rng) * bound) >> 64;
+#else
+  return rng_next(rng) % bound;
+#endif
+}
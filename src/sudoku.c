@@ -1,22 +1,84 @@
+#define _POSIX_C_SOURCE 200809L /* open_memstream() */
+
 #include "sudoku.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "grid.h"
+#include "lines.h"
+#include "parallel.h"
 
 #define DEFAULT_SIZE 9
+#define FISH_ORDER 3            /* order of the fish given by '-H' alone */
+#define ADAPTIVE_RATIO 0.05     /* default threshold of '--adaptive' */
+#define PIPELINE_SLOTS 64       /* grids in a pipeline for each solver */
+#define OUTPUT_BUFFER (1 << 20) /* buffer of a redirected output with '-l' */
+
+/* Options of the solver, read by all jobs */
+typedef struct
+{
+  bool all;
+  bool numeric;
+  bool lines;      /* one grid per line */
+  bool packed;     /* the output is the packed solutions, nothing else */
+  bool ordered;    /* a pipeline writes the grids in the order they are read */
+  size_t threads;  /* solvers of a pipeline */
+  bool verbose;
+  search_t search; /* options of the searches, pipeline included */
+} options_t;
+
+/* Solving of a file given on the command line */
+typedef struct
+{
+  const char *file_name;
+  FILE *output;  /* report of the job */
+  char *buffer;  /* memory stream of 'output' in batch mode */
+  size_t length;
+  bool error;    /* the file cannot be read, or the grid has no solution */
+  bool done;
+  rng_t rng;     /* stream of the job, split from the seed */
+} job_t;
+
+/* Jobs solved by a pool of threads, the reports being written in the order
+   of the command line */
+typedef struct
+{
+  const options_t *options;
+  job_t *jobs;
+  size_t jobs_count;
+  size_t next;           /* next job to start */
+  pthread_mutex_t lock;  /* protects 'next' and the 'done' of the jobs */
+  pthread_cond_t done;
+} batch_t;
+
+/* Opens a grid file, '-' standing for the standard input */
+static FILE *input_open(const char *file_name)
+{
+  return (strcmp(file_name, "-") == 0) ? stdin : fopen(file_name, "r");
+}
 
-static bool verbose = false;
-static FILE *output;
-static bool error = false;
+/* Closes a file opened by input_open() */
+static void input_close(FILE *file)
+{
+  if (file != stdin)
+  {
+    fclose(file);
+  }
+}
 
-static grid_t *file_parser(char *file_name)
+static grid_t *file_parser(const char *file_name)
 {
-  FILE *file = fopen(file_name, "r");
+  FILE *file = input_open(file_name);
   if (file == NULL)
   {
     warn("Error on file %s", file_name);
@@ -24,7 +86,7 @@ static grid_t *file_parser(char *file_name)
   }
 
   size_t size_row = 0; /* for size of row */
-  char row[MAX_GRID_SIZE];
+  char row[TABLE_COLORS];
   int c = fgetc(file);
   bool comment = false;
 
@@ -44,7 +106,10 @@ static grid_t *file_parser(char *file_name)
 
     if (!(comment) && c != '\n' && c != '\t' && c != '\r' && c != ' ')
     {
-      row[size_row] = c;
+      if (size_row < TABLE_COLORS)
+      {
+        row[size_row] = c;
+      }
       size_row++;
     }
     /* '\r' for Windows Users... */
@@ -63,17 +128,17 @@ static grid_t *file_parser(char *file_name)
             " one significant character, not %zu.\n",
             file_name, size_row);
     }
-    fclose(file);
+    input_close(file);
     return NULL;
   }
 
-  if (size_row != 1 && size_row != 4 && size_row != 9 && size_row != 16 &&
-      size_row != 25 && size_row != 36 && size_row != 49 && size_row != 64)
+  if (!grid_check_size(size_row) || size_row > TABLE_COLORS)
   {
     warnx("Warning: In file %s, number of significant characters in line"
-          " 1: %zu is not an accepted size.\n",
-          file_name, size_row);
-    fclose(file);
+          " 1: %zu is not an accepted size%s.\n",
+          file_name, size_row,
+          grid_check_size(size_row) ? " (use -n for numbers)" : "");
+    input_close(file);
     return NULL;
   }
 
@@ -82,7 +147,7 @@ static grid_t *file_parser(char *file_name)
   if (grid == NULL)
   {
     warnx("Error: Impossible to alloc memory for a new grid\n");
-    fclose(file);
+    input_close(file);
     return NULL;
   }
 
@@ -131,7 +196,10 @@ static grid_t *file_parser(char *file_name)
                 file_name, c, size_row + 1, line + 1, expected_size);
           goto error_file;
         }
-        row[size_row] = c;
+        if (size_row < expected_size)
+        {
+          row[size_row] = c;
+        }
         size_row++;
       }
       c = fgetc(file);
@@ -177,176 +245,1429 @@ static grid_t *file_parser(char *file_name)
       goto error_file;
     }
   }
-  fclose(file);
+  input_close(file);
   return grid;
 
   /* ====================== Where goto:error_file leads ===================== */
 error_file:
   grid_free(grid);
-  fclose(file);
+  input_close(file);
   return NULL;
 }
 
-int main(int argc, char *argv[])
+/* Reads the next line holding numbers in a file written with numbers:
+   numbers are separated by spaces, '_', '.' and '0' stand for empty cells and
+   '#' starts a comment. Stores at most max_count numbers (0 for an empty
+   cell) and returns how many were found on the line, or -1 if a character
+   is not accepted (*bad receives it). *eof is set at the end of the file. */
+static long numeric_line(FILE *file, size_t numbers[], const size_t max_count,
+                         bool *eof, int *bad)
 {
-  const struct option long_opts[] = {{"all", no_argument, NULL, 'a'},
-                                     {"generate", optional_argument, NULL, 'g'},
-                                     {"output", required_argument, NULL, 'o'},
-                                     {"unique", no_argument, NULL, 'u'},
-                                     {"verbose", no_argument, NULL, 'v'},
-                                     {"version", no_argument, NULL, 'V'},
-                                     {"help", no_argument, NULL, 'h'},
-                                     {NULL, 0, NULL, 0}};
-
-  int optc;
-  bool all = false;
-  bool unique = false;
-  bool generator = false;
-  int size = DEFAULT_SIZE;
-  output = stdout;
-  char *output_name = NULL;
+  long count = 0;
+  bool comment = false;
+  bool in_number = false;
+  size_t number = 0;
+  int c = fgetc(file);
 
-  while ((optc = getopt_long(argc, argv, "ag::o:uvVh", long_opts, NULL)) != -1)
-    switch (optc)
+  while (c != EOF && !(c == '\n' && (count != 0 || in_number)))
+  {
+    if (c == '#')
     {
-      case 'a':
-        all = true;
-        break;
+      comment = true;
+    }
+    else if (c == '\n')
+    {
+      comment = false;
+    }
 
-      case 'h':
-        printf(
-            "Usage: sudoku [-a|-o FILE|-v|-V|-h] FILE...\n"
-            "       sudoku -g[SIZE] [-u|-o FILE|-v|-V|-h]\n"
-            "Solve or generate Sudoku grids of size: "
-            "1, 4, 9, 16, 25, 36, 49, 64\n"
-            "\n"
-            " -a,--all               search for all possible solutions\n"
-            " -g[N],--generate[N]    generate a grid of size NxN (default:9)\n"
-            " -o FILE,--output FILE  write output to FILE "
-            "(appends the end of FILE if it already exists)\n"
-            " -u,--unique            generate a grid with unique solution\n"
-            " -v,--verbose           verbose output\n"
-            " -V,--version           display version and exit\n"
-            " -h,--help              display this help and exit\n");
-        exit(EXIT_SUCCESS);
+    if (!comment && c >= '0' && c <= '9')
+    {
+      in_number = true;
+      number = (number > MAX_GRID_SIZE) ? number : 10 * number + (c - '0');
+    }
+    else
+    {
+      if (in_number)
+      {
+        if ((size_t)count < max_count)
+        {
+          numbers[count] = number;
+        }
+        count++;
+        in_number = false;
+        number = 0;
+      }
 
-      case 'g':
-        generator = true;
-        if (optarg)
+      if (!comment && (c == EMPTY_CELL || c == '.'))
+      {
+        if ((size_t)count < max_count)
         {
-          size = atoi(optarg);
-          if (size != 1 && size != 4 && size != 9 && size != 16 && size != 25 &&
-              size != 36 && size != 49 && size != 64)
-          {
-            errx(EXIT_FAILURE, "Error: Please choose one of "
-                               "these sizes: 1, 4, 9, 16, 25, 36,"
-                               " 49, 64");
-          }
+          numbers[count] = 0;
         }
-        break;
+        count++;
+      }
+      else if (!comment && c != '\n' && c != '\t' && c != '\r' && c != ' ')
+      {
+        *bad = c;
+        return -1;
+      }
+    }
+    c = fgetc(file);
+  }
 
-      case 'V':
-        printf("sudoku %d.%d.%d\nSolve/generate sudoku grids of size: 1,"
-               " 4, 9, 16, 25, 36, 49, 64\n",
-               VERSION, SUBVERSION, REVISION);
-        exit(EXIT_SUCCESS);
+  if (in_number)
+  {
+    if ((size_t)count < max_count)
+    {
+      numbers[count] = number;
+    }
+    count++;
+  }
 
-      case 'o':
-        output_name = optarg; /* In case of multiple uses of '-o' */
-        break;
+  *eof = (c == EOF);
+  return count;
+}
 
-      case 'v':
-        verbose = true;
-        break;
+/* Same as file_parser(), for grids written with numbers (option -n) */
+static grid_t *numeric_file_parser(const char *file_name)
+{
+  FILE *file = input_open(file_name);
+  if (file == NULL)
+  {
+    warn("Error on file %s", file_name);
+    return NULL;
+  }
 
-      case 'u':
-        unique = true;
-        break;
+  size_t numbers[MAX_GRID_SIZE];
+  bool eof = false;
+  int bad = 0;
+  long count = numeric_line(file, numbers, MAX_GRID_SIZE, &eof, &bad);
 
-      default:
-        errx(EXIT_FAILURE,
-             "Error: You chose an unrecognized option: "
-             "'%s'.\n"
-             "Software is now closing.\n",
-             argv[optind - 1]);
-    }
+  if (count < 0)
+  {
+    warnx("Warning: In file %s, character '%c' in line 1 is not accepted.\n",
+          file_name, bad);
+    input_close(file);
+    return NULL;
+  }
 
-  if (output_name != NULL) /* Means '-o' has been used. */
+  size_t size = count;
+  if (!grid_check_size(size))
   {
-    output = fopen(output_name, "a");
-    if (output == NULL)
+    warnx("Warning: In file %s, number of cells in line 1: %zu is not an "
+          "accepted size.\n",
+          file_name, size);
+    input_close(file);
+    return NULL;
+  }
+
+  grid_t *grid = grid_alloc(size);
+
+  if (grid == NULL)
+  {
+    warnx("Error: Impossible to alloc memory for a new grid\n");
+    input_close(file);
+    return NULL;
+  }
+  grid_set_numeric(grid, true);
+
+  for (size_t line = 0; line < size; line++)
+  {
+    if (line != 0)
     {
-      error = true;
-      warn("Error on output file %s", output_name);
-      output = stdout;
+      if (eof)
+      {
+        warnx("Warning: In file %s, you have only %zu lines. You need %zu to "
+              "respect your first line size.\n",
+              file_name, line, size);
+        goto error_file;
+      }
+
+      count = numeric_line(file, numbers, size, &eof, &bad);
+      if (count < 0)
+      {
+        warnx("Warning: In file %s, character '%c' in line %zu is not "
+              "accepted.\n",
+              file_name, bad, line + 1);
+        goto error_file;
+      }
+
+      if ((size_t)count != size)
+      {
+        warnx("Warning: In file %s, line %zu has %ld cells. You need %zu to "
+              "respect your first line size.\n",
+              file_name, line + 1, count, size);
+        goto error_file;
+      }
     }
-    else
+
+    for (size_t j = 0; j < size; j++)
     {
-      fprintf(output, "# Here is your software output:\n\n");
+      if (numbers[j] > size)
+      {
+        warnx("Warning: In file %s, number %zu in column %zu, line %zu is not "
+              "accepted for grids of size %zu.\n",
+              file_name, numbers[j], j + 1, line + 1, size);
+        goto error_file;
+      }
+      grid_set_cell_number(grid, line, j, numbers[j]);
     }
   }
 
-  if (generator && all)
+  /* Let's check there is not another line */
+  if (!eof && numeric_line(file, numbers, 0, &eof, &bad) != 0)
   {
-    warnx("Warning: You are in GENERATOR mode and therefore, you can't"
-          " search for solutions. Option '-a/--all' has been disabled.\n");
-    all = false;
+    warnx("Warning: Too much lines in your file %s.\n", file_name);
+    goto error_file;
   }
+  input_close(file);
+  return grid;
 
-  if (unique && !generator)
+error_file:
+  grid_free(grid);
+  input_close(file);
+  return NULL;
+}
+
+/* Reads a grid written on a single line of size * size characters (option
+   '-l'), '.' and '0' also standing for empty cells. The cells are written in
+   'grid' if it has the right size (else it is freed), so that a stream of
+   grids is read without allocations. */
+static grid_t *line_parser(const char *file_name, const size_t line_number,
+                           const char *line, const size_t length,
+                           grid_t *grid)
+{
+  size_t size = 1;
+  while (size * size < length)
   {
-    warnx("Warning: You are in SOLVER mode and therefore, you can't  "
-          "generate a grid. Option '-u/--unique' has been disabled.\n");
-    unique = false;
+    size++;
   }
 
-  if (!generator) /* User mode */
+  if (size * size != length || !grid_check_size(size) || size > TABLE_COLORS)
   {
-    if (argc == optind)
+    warnx("Warning: In file %s, line %zu has %zu significant characters, "
+          "which is not the number of cells of an accepted size.\n",
+          file_name, line_number, length);
+    grid_free(grid);
+    return NULL;
+  }
+
+  if (grid_get_size(grid) != size)
+  {
+    grid_free(grid);
+    grid = grid_alloc(size);
+
+    if (grid == NULL)
     {
-      errx(EXIT_FAILURE, "Error: In solver mode, please give an existing and"
-                         " readable file as last argument.");
+      warnx("Error: Impossible to alloc memory for a new grid\n");
+      return NULL;
     }
+    grid_set_line(grid, true);
+  }
 
-    for (int i = optind; i < argc; i++)
+  for (size_t i = 0; i < length; i++)
+  {
+    char c = (line[i] == '.' || line[i] == '0') ? EMPTY_CELL : line[i];
+    if (!grid_check_char(grid, c))
     {
-      grid_t *grid = file_parser(argv[i]);
+      warnx("Warning: In file %s, character '%c' in column %zu, line %zu is "
+            "not accepted for grids of size %zu.\n",
+            file_name, line[i], i + 1, line_number, size);
+      grid_free(grid);
+      return NULL;
+    }
+    grid_set_cell(grid, i / size, i % size, c);
+  }
+  return grid;
+}
 
-      if (grid != NULL)
-      {
-        fprintf(output, "\nHere is the grid of file %s:\n\n", argv[i]);
-        grid_print(grid, output);
+/* Returns the time elapsed since an arbitrary point, in seconds */
+static double clock_seconds(void)
+{
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
 
-        if (!all)
-        {
-          grid = grid_solver(grid, mode_first, NULL, NULL, false);
+/* Writes the list of accepted grid sizes */
+static void print_sizes(FILE *fd)
+{
+  for (size_t sqr = 1; sqr * sqr <= MAX_GRID_SIZE; sqr++)
+  {
+    fprintf(fd, sqr == 1 ? "%zu" : ", %zu", sqr * sqr);
+  }
+}
 
-          if (grid == NULL)
-          {
-            fprintf(output, "Grid is not consistent.\n");
-            error = true;
-          }
+/* Reads the value of a numeric option, in 'base' (0: also 0x... or 0...),
+   exiting if it is not a whole number up to 'max' */
+static uint64_t parse_number(const char *arg, const char *option,
+                             const uint64_t max, const int base)
+{
+  char *end;
+  errno = 0;
+  unsigned long long number = strtoull(arg, &end, base);
+  if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno != 0 ||
+      number > max)
+  {
+    errx(EXIT_FAILURE, "Error: Invalid value '%s' for %s", arg, option);
+  }
+  return number;
+}
 
-          else
-          {
-            fprintf(output, "Grid has been solved, here is the solution:\n");
-            grid_print(grid, output);
-            grid_free(grid);
-          }
-        }
+/* Reads the value of a ratio option, exiting if it is not a number */
+static double parse_ratio(const char *arg, const char *option)
+{
+  char *end;
+  errno = 0;
+  double ratio = strtod(arg, &end);
+  if (end == arg || *end != '\0' || errno != 0 || !(ratio >= 0))
+  {
+    errx(EXIT_FAILURE, "Error: Invalid value '%s' for %s", arg, option);
+  }
+  return ratio;
+}
 
-        else /* --all */
-        {
-          grid_solver(grid, mode_all, &error, output, false);
-          grid_free(grid);
-        }
-      }
+/* Reads a restart policy, followed by ':' and the budget of the first run */
+static void parse_restarts(char *arg, restart_policy_t *policy, size_t *base)
+{
+  char *name = strtok(arg, ":");
+  char *budget = strtok(NULL, ":");
+
+  if (name != NULL && strcmp(name, "luby") == 0)
+  {
+    *policy = restart_luby;
+  }
+  else if (name != NULL && strcmp(name, "geometric") == 0)
+  {
+    *policy = restart_geometric;
+  }
+  else if (name != NULL && strcmp(name, "none") == 0)
+  {
+    *policy = restart_none;
+  }
+  else
+  {
+    errx(EXIT_FAILURE, "Error: Unknown restart policy '%s', please choose "
+                       "luby, geometric or none",
+         arg);
+  }
+
+  *base = (budget != NULL) ? parse_number(budget, "-r", SIZE_MAX, 10) : 0;
+}
 
-      else /* file_parser returned NULL */
+/* Reads a comma-separated list of heuristics in a pipeline */
+static void parse_rules(char *list, search_t *pipeline)
+{
+  pipeline->rules_count = 0;
+  pipeline->rules_set = true;
+
+  for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+  {
+    if (strcmp(name, "none") == 0)
+    {
+      continue;
+    }
+
+    rule_t rule = 0;
+    while (rule < RULES_COUNT && strcmp(name, grid_rule_name(rule)) != 0)
+    {
+      rule++;
+    }
+
+    if (rule == RULES_COUNT)
+    {
+      errx(EXIT_FAILURE, "Error: Unknown heuristic '%s', please choose "
+                         "singles, naked, hidden, intersections, fish, "
+                         "alldiff or none",
+           name);
+    }
+
+    for (size_t i = 0; i < pipeline->rules_count; i++)
+    {
+      if (pipeline->rules[i] == rule)
       {
-        error = true;
+        errx(EXIT_FAILURE, "Error: Heuristic '%s' is given twice", name);
       }
     }
+    pipeline->rules[pipeline->rules_count++] = rule;
+  }
+}
+
+/* Sets the pipeline of a search: the one given by '-H' or the default one,
+   with the fish of '-f' and the all-different filtering of '-A' */
+static void set_rules(search_t *search, const search_t *pipeline,
+                      const bool alldiff)
+{
+  if (pipeline->rules_set)
+  {
+    for (size_t i = 0; i < pipeline->rules_count; i++)
+    {
+      search->rules[i] = pipeline->rules[i];
+    }
+    search->rules_count = pipeline->rules_count;
+    search->rules_set = true;
+  }
+  else
+  {
+    grid_rules_default(search);
+  }
+
+  if (search->fish_order >= 2)
+  {
+    grid_rules_add(search, rule_fish);
+  }
+  else
+  {
+    search->fish_order = FISH_ORDER;
+  }
+
+  if (alldiff)
+  {
+    grid_rules_add(search, rule_alldiff);
+  }
+}
+
+/* Writes the work of each heuristic of a search, all depths together */
+static void print_rules_stats(const search_t *search, FILE *output)
+{
+  for (size_t i = 0; i < search->rules_count; i++)
+  {
+    rule_t rule = search->rules[i];
+    rule_stats_t total = {0};
+    for (size_t band = 0; band < RULE_BANDS; band++)
+    {
+      const rule_stats_t *stats = &search->rules_stats[rule][band];
+      total.calls += stats->calls;
+      total.removed += stats->removed;
+      total.seconds += stats->seconds;
+      total.skipped += stats->skipped;
+    }
+
+    fprintf(output,
+            "Heuristic %s: %zu calls, %zu candidates removed in %.3f s "
+            "(%.3f per us)",
+            grid_rule_name(rule), total.calls, total.removed, total.seconds,
+            total.seconds > 0 ? total.removed / (total.seconds * 1e6) : 0.0);
+    if (total.skipped != 0)
+    {
+      fprintf(output, ", %zu calls skipped", total.skipped);
+    }
+    if (rule == rule_fish)
+    {
+      fprintf(output, ", %zu nodes decided without a choice",
+              search->fish_decided);
+    }
+    fprintf(output, "\n");
+  }
+}
+
+/* Writes the options of the portfolio member which found the solution */
+static void print_winner(const search_t *search, FILE *output)
+{
+  static const char *const policies[] = {[choice_position] = "position",
+                                         [choice_first] = "first",
+                                         [choice_degree] = "degree"};
+  search_t config = *search;
+  portfolio_config(&config, search->winner);
+
+  fprintf(output, "Portfolio: member %zu of %zu won (%s choices, tie-break %s, "
+                  "heuristics ",
+          search->winner, search->portfolio,
+          config.random ? "random" : "ordered", policies[config.tie_break]);
+  for (size_t i = 0; i < config.rules_count; i++)
+  {
+    fprintf(output, i == 0 ? "%s" : ",%s", grid_rule_name(config.rules[i]));
+  }
+  fprintf(output, ")\n");
+}
+
+/* Grid of a file in the line format, with its outcome */
+typedef struct
+{
+  size_t index;       /* rank of the grid in the file */
+  size_t line_number;
+  grid_t *grid;       /* the grid, then its solution in mode_first, NULL if
+                         it cannot be read or has no solution */
+  bool read;          /* false if the line is not a grid */
+  bool error;         /* no solution */
+  bool cut;           /* branches given up because of max_depth */
+  size_t nodes;
+  char *buffer;       /* solutions printed in mode_all by a pipeline */
+  size_t length;
+  rng_t rng;          /* stream of the grid, split from the one of the job */
+} slot_t;
+
+/* Pipeline solving a file in the line format with several threads (option
+   '-l' with '-j'): the reader reads the grids in the free slots, the solvers
+   solve the slots read, and the writer writes the slots solved before giving
+   them back to the reader. The reader waits when all slots are in use, so
+   that the grids read ahead of the writer stay bounded. */
+typedef struct
+{
+  const options_t *options;
+  job_t *job;
+  FILE *output;
+  size_t threads;    /* solvers */
+  slot_t *slots;
+  size_t slots_count;
+  queue_t free;      /* slots for the reader */
+  queue_t read;      /* slots for the solvers, then one NULL per solver */
+  queue_t solved;    /* slots for the writer, then one NULL per solver */
+  size_t grids;      /* statistics kept by the writer */
+  size_t solved_count;
+  size_t nodes;
+} pipeline_t;
+
+/* Returns false at the end of a file in the line format, else gives the next
+   line holding a grid, skipping empty lines and comments */
+static bool grid_line(lines_t *lines, size_t *line_number, const char **line,
+                      size_t *length)
+{
+  while (lines_next(lines, line, length))
+  {
+    (*line_number)++;
+    if (*length != 0 && (*line)[*length - 1] == '\r') /* for Windows users */
+    {
+      (*length)--;
+    }
+    if (*length != 0 && (*line)[0] != '#')
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Reads the grid of a line in a slot */
+static void slot_read(const options_t *options, job_t *job, slot_t *slot,
+                      const size_t line_number, const char *line,
+                      const size_t length)
+{
+  slot->line_number = line_number;
+  slot->grid = line_parser(job->file_name, line_number, line, length,
+                           slot->grid);
+  slot->read = (slot->grid != NULL);
+  grid_set_packed(slot->grid, options->packed);
+  slot->error = !slot->read;
+  slot->cut = false;
+  slot->nodes = 0;
+  rng_split(&job->rng, &slot->rng);
+}
+
+/* Solves the grid of a slot, the solutions being printed in 'output' in
+   mode_all */
+static void slot_solve(const options_t *options, slot_t *slot, FILE *output)
+{
+  if (!slot->read)
+  {
+    return;
+  }
+
+  search_t search = options->search;
+  search.rng = &slot->rng;
+
+  if (!options->all)
+  {
+    slot->grid = grid_solver(slot->grid, mode_first, NULL, NULL, &search);
+    slot->error = (slot->grid == NULL);
+  }
+  else /* --all */
+  {
+    grid_solver(slot->grid, mode_all, &slot->error, output, &search);
+  }
+
+  slot->cut = search.cut;
+  slot->nodes = search.nodes;
+}
+
+/* Writes the outcome of a slot: the solution on its line, or a line
+   starting with '#' when the grid cannot be read or solved */
+static void slot_write(const options_t *options, job_t *job, slot_t *slot,
+                       FILE *output)
+{
+  if (!slot->read)
+  {
+    if (!options->packed)
+    {
+      fprintf(output, "# Line %zu: not a grid\n", slot->line_number);
+    }
+  }
+  else if (options->all)
+  {
+    if (slot->buffer != NULL) /* else printed as they were found */
+    {
+      fwrite(slot->buffer, 1, slot->length, output);
+    }
+  }
+  else if (slot->error && slot->cut)
+  {
+    fprintf(output, "# Line %zu: no solution found within %zu choices\n",
+            slot->line_number, options->search.max_depth);
+  }
+  else if (slot->error)
+  {
+    fprintf(output, "# Line %zu: grid is not consistent\n",
+            slot->line_number);
+  }
+  else
+  {
+    grid_print(slot->grid, output);
+  }
+
+  free(slot->buffer);
+  slot->buffer = NULL;
+  slot->length = 0;
+  job->error |= slot->error;
+}
+
+/* Solver of a pipeline: solves the slots read until it gets NULL */
+static void *pipeline_solve(void *arg)
+{
+  pipeline_t *pipeline = arg;
+  slot_t *slot;
+
+  while ((slot = queue_pop(&pipeline->read)) != NULL)
+  {
+    FILE *output = NULL;
+    if (pipeline->options->all && slot->read)
+    {
+      output = open_memstream(&slot->buffer, &slot->length);
+      if (output == NULL)
+      {
+        err(EXIT_FAILURE, "Error: Impossible to open the solutions of a "
+                          "grid");
+      }
+    }
+
+    slot_solve(pipeline->options, slot, output);
+
+    if (output != NULL)
+    {
+      fclose(output);
+    }
+    queue_push(&pipeline->solved, slot);
+  }
+
+  queue_push(&pipeline->solved, NULL);
+  return NULL;
+}
+
+/* Writer of a pipeline, until all the solvers are over. With '--ordered',
+   a slot solved early waits for the ones before it: as the reader takes the
+   slots in order, the slots in use have consecutive ranks, and the slot of
+   rank r waits at r modulo the number of slots. */
+static void *pipeline_write(void *arg)
+{
+  pipeline_t *pipeline = arg;
+  slot_t **waiting = calloc(pipeline->slots_count, sizeof(slot_t *));
+  if (waiting == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the writer of a pipeline");
+  }
+  size_t next = 0; /* rank of the next slot to write with '--ordered' */
+  size_t solvers = pipeline->threads;
+
+  while (solvers != 0)
+  {
+    slot_t *slot = queue_pop(&pipeline->solved);
+    if (slot == NULL)
+    {
+      solvers--;
+      continue;
+    }
+
+    if (pipeline->options->ordered)
+    {
+      waiting[slot->index % pipeline->slots_count] = slot;
+      slot = waiting[next % pipeline->slots_count];
+    }
+
+    while (slot != NULL)
+    {
+      pipeline->grids++;
+      pipeline->solved_count += !slot->error;
+      pipeline->nodes += slot->nodes;
+      slot_write(pipeline->options, pipeline->job, slot, pipeline->output);
+      queue_push(&pipeline->free, slot);
+      slot = NULL;
+
+      if (pipeline->options->ordered)
+      {
+        waiting[next % pipeline->slots_count] = NULL;
+        next++;
+        slot = waiting[next % pipeline->slots_count];
+      }
+    }
+  }
+
+  free(waiting);
+  return NULL;
+}
+
+/* Solves the grids of a file in the line format with a pipeline of
+   options->threads solvers. Returns the statistics in *grids, *solved and
+   *nodes. */
+static void pipeline_run(const options_t *options, job_t *job, lines_t *lines,
+                         size_t *grids, size_t *solved, size_t *nodes)
+{
+  pipeline_t pipeline = {.options = options,
+                         .job = job,
+                         .output = job->output,
+                         .threads = options->threads,
+                         .slots_count = PIPELINE_SLOTS * options->threads};
+
+  pipeline.slots = calloc(pipeline.slots_count, sizeof(slot_t));
+  size_t capacity = pipeline.slots_count + pipeline.threads;
+  if (pipeline.slots == NULL || !queue_init(&pipeline.free, capacity) ||
+      !queue_init(&pipeline.read, capacity) ||
+      !queue_init(&pipeline.solved, capacity))
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the pipeline of %s",
+        job->file_name);
+  }
+
+  for (size_t i = 0; i < pipeline.slots_count; i++)
+  {
+    queue_push(&pipeline.free, &pipeline.slots[i]);
+  }
+
+  pthread_t writer;
+  pthread_t *solvers = malloc(pipeline.threads * sizeof(pthread_t));
+  if (solvers == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the threads of a pipeline");
+  }
+  for (size_t i = 0; i < pipeline.threads; i++)
+  {
+    if (pthread_create(&solvers[i], NULL, pipeline_solve, &pipeline) != 0)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to start a thread");
+    }
+  }
+  if (pthread_create(&writer, NULL, pipeline_write, &pipeline) != 0)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to start a thread");
+  }
+
+  /* The calling thread is the reader */
+  size_t line_number = 0;
+  const char *line;
+  size_t length;
+  for (size_t index = 0;
+       grid_line(lines, &line_number, &line, &length); index++)
+  {
+    slot_t *slot = queue_pop(&pipeline.free);
+    slot->index = index;
+    slot_read(options, job, slot, line_number, line, length);
+    queue_push(&pipeline.read, slot);
+  }
+
+  for (size_t i = 0; i < pipeline.threads; i++)
+  {
+    queue_push(&pipeline.read, NULL);
+  }
+  for (size_t i = 0; i < pipeline.threads; i++)
+  {
+    pthread_join(solvers[i], NULL);
+  }
+  pthread_join(writer, NULL);
+
+  *grids = pipeline.grids;
+  *solved = pipeline.solved_count;
+  *nodes = pipeline.nodes;
+
+  for (size_t i = 0; i < pipeline.slots_count; i++)
+  {
+    grid_free(pipeline.slots[i].grid);
+  }
+  free(solvers);
+  free(pipeline.slots);
+  queue_destroy(&pipeline.free);
+  queue_destroy(&pipeline.read);
+  queue_destroy(&pipeline.solved);
+}
+
+/* Solves the grids of a job in the line format: each solution is written on
+   its own line, and a line starting with '#' tells when a grid cannot be
+   read or solved. With several threads, the grids are solved by a pipeline,
+   else one after the other. */
+static void solve_lines(const options_t *options, job_t *job)
+{
+  lines_t lines;
+  if (!lines_open(&lines, job->file_name))
+  {
+    job->error = true;
+    return;
+  }
+
+  size_t grids = 0;
+  size_t solved = 0;
+  size_t nodes = 0;
+  double start = clock_seconds();
+
+  if (options->threads > 1)
+  {
+    pipeline_run(options, job, &lines, &grids, &solved, &nodes);
+  }
+  else
+  {
+    slot_t slot = {.grid = NULL};
+    size_t line_number = 0;
+    const char *line;
+    size_t length;
+
+    while (grid_line(&lines, &line_number, &line, &length))
+    {
+      slot_read(options, job, &slot, line_number, line, length);
+      slot_solve(options, &slot, job->output);
+      grids++;
+      solved += !slot.error;
+      nodes += slot.nodes;
+      slot_write(options, job, &slot, job->output);
+    }
+    grid_free(slot.grid);
+  }
+
+  lines_close(&lines);
+  job->error |= lines.error;
+
+  if (options->verbose)
+  {
+    double seconds = clock_seconds() - start;
+    fprintf(options->packed ? stderr : job->output,
+            "# File %s: %zu grids, %zu solved in %.3f s (%.0f grids/s), "
+            "%zu nodes\n",
+            job->file_name, grids, solved, seconds,
+            (seconds > 0) ? grids / seconds : 0, nodes);
+  }
+}
+
+/* Reads and solves the grid of a job, writing the report in its output */
+static void solve_file(const options_t *options, job_t *job)
+{
+  if (options->lines)
+  {
+    solve_lines(options, job);
+    return;
+  }
+
+  FILE *output = job->output;
+  grid_t *grid = options->numeric ? numeric_file_parser(job->file_name)
+                                  : file_parser(job->file_name);
+
+  if (grid == NULL)
+  {
+    job->error = true;
+    return;
+  }
+
+  if (!options->packed)
+  {
+    fprintf(output, "\nHere is the grid of file %s:\n\n", job->file_name);
+    grid_print(grid, output);
+  }
+  grid_set_packed(grid, options->packed);
+
+  search_t search = options->search;
+  search.rng = &job->rng;
+  bool solved = false;
+
+  if (!options->all)
+  {
+    grid = grid_solver(grid, mode_first, NULL, NULL, &search);
+
+    if (grid == NULL)
+    {
+      if (search.cut)
+      {
+        fprintf(output, "No solution found within %zu choices.\n",
+                search.max_depth);
+      }
+      else
+      {
+        fprintf(output, "Grid is not consistent.\n");
+      }
+      job->error = true;
+    }
+
+    else
+    {
+      fprintf(output, "Grid has been solved, here is the solution:\n");
+      grid_print(grid, output);
+      grid_free(grid);
+      solved = true;
+    }
+  }
+
+  else /* --all */
+  {
+    grid_solver(grid, mode_all, &job->error, output, &search);
+    grid_free(grid);
+  }
+
+  if (options->verbose)
+  {
+    output = options->packed ? stderr : output; /* keeps the stream packed */
+    fprintf(output, "Search: %zu nodes, maximal depth %zu%s\n", search.nodes,
+            search.depth, search.cut ? " (depth limit reached)" : "");
+    print_rules_stats(&search, output);
+    if (search.portfolio > 1 && solved && search.engine == engine_backtrack)
+    {
+      print_winner(&search, output);
+    }
+    if (search.restart_policy != restart_none &&
+        search.engine == engine_backtrack)
+    {
+      fprintf(output, "Search: %zu restarts\n", search.restarts);
+    }
+    if (search.engine == engine_cdcl)
+    {
+      fprintf(output, "Search: %zu conflicts, %zu restarts\n",
+              search.conflicts, search.restarts);
+    }
+  }
+}
+
+/* Thread of a batch: solves the next job not started yet, in a memory
+   stream, until all jobs are started */
+static void *batch_run(void *arg)
+{
+  batch_t *batch = arg;
+
+  while (true)
+  {
+    pthread_mutex_lock(&batch->lock);
+    size_t index = batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+
+    if (index >= batch->jobs_count)
+    {
+      return NULL;
+    }
+
+    job_t *job = &batch->jobs[index];
+    job->output = open_memstream(&job->buffer, &job->length);
+    if (job->output == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to open the report of %s",
+          job->file_name);
+    }
+    solve_file(batch->options, job);
+    fclose(job->output);
+
+    pthread_mutex_lock(&batch->lock);
+    job->done = true;
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+  }
+}
+
+/* Solves the jobs with 'threads' threads, writing their reports in
+   'output' in the order of the jobs, each one as soon as it and the ones
+   before it are done */
+static void batch_solve(const options_t *options, job_t jobs[],
+                        const size_t jobs_count, const size_t threads,
+                        FILE *output)
+{
+  batch_t batch = {.options = options,
+                   .jobs = jobs,
+                   .jobs_count = jobs_count,
+                   .next = 0};
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.done, NULL);
+
+  pthread_t *workers = malloc(threads * sizeof(pthread_t));
+  if (workers == NULL)
+  {
+    err(EXIT_FAILURE, "Error: Impossible to alloc the threads of a batch");
+  }
+
+  for (size_t i = 0; i < threads; i++)
+  {
+    if (pthread_create(&workers[i], NULL, batch_run, &batch) != 0)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to start a thread");
+    }
+  }
+
+  for (size_t i = 0; i < jobs_count; i++)
+  {
+    pthread_mutex_lock(&batch.lock);
+    while (!jobs[i].done)
+    {
+      pthread_cond_wait(&batch.done, &batch.lock);
+    }
+    pthread_mutex_unlock(&batch.lock);
+
+    fwrite(jobs[i].buffer, 1, jobs[i].length, output);
+    free(jobs[i].buffer);
+    jobs[i].buffer = NULL;
+  }
+
+  for (size_t i = 0; i < threads; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+
+  free(workers);
+  pthread_cond_destroy(&batch.done);
+  pthread_mutex_destroy(&batch.lock);
+}
+
+int main(int argc, char *argv[])
+{
+  const struct option long_opts[] = {{"adaptive", optional_argument, NULL,
+                                      'D'},
+                                     {"all", no_argument, NULL, 'a'},
+                                     {"alldiff", no_argument, NULL, 'A'},
+                                     {"count", no_argument, NULL, 'C'},
+                                     {"engine", required_argument, NULL, 'e'},
+                                     {"fish", required_argument, NULL, 'f'},
+                                     {"generate", optional_argument, NULL, 'g'},
+                                     {"heuristics", required_argument, NULL,
+                                      'H'},
+                                     {"jobs", required_argument, NULL, 'j'},
+                                     {"lines", no_argument, NULL, 'l'},
+                                     {"max-depth", required_argument, NULL,
+                                      'd'},
+                                     {"max-solutions", required_argument,
+                                      NULL, 'M'},
+                                     {"numeric", no_argument, NULL, 'n'},
+                                     {"portfolio", required_argument, NULL,
+                                      'P'},
+                                     {"ordered", no_argument, NULL, 'O'},
+                                     {"packed", no_argument, NULL, 'B'},
+                                     {"output", required_argument, NULL, 'o'},
+                                     {"random", no_argument, NULL, 'R'},
+                                     {"restarts", required_argument, NULL,
+                                      'r'},
+                                     {"seed", required_argument, NULL, 's'},
+                                     {"tie-break", required_argument, NULL,
+                                      't'},
+                                     {"unique", no_argument, NULL, 'u'},
+                                     {"verbose", no_argument, NULL, 'v'},
+                                     {"version", no_argument, NULL, 'V'},
+                                     {"help", no_argument, NULL, 'h'},
+                                     {NULL, 0, NULL, 0}};
+
+  int optc;
+  bool verbose = false;
+  FILE *output = stdout;
+  bool error = false;
+  bool all = false;
+  bool alldiff = false;
+  bool unique = false;
+  bool generator = false;
+  bool numeric = false;
+  bool lines = false;
+  bool ordered = false;
+  bool count_only = false;
+  bool packed = false;
+  uint64_t max_solutions = 0;
+  int size = DEFAULT_SIZE;
+  size_t max_depth = 0;
+  size_t threads = 1;
+  size_t portfolio = 0;
+  bool random = false;
+  restart_policy_t restart_policy = restart_none;
+  size_t restart_base = 0;
+  size_t fish_order = 0;
+  double adaptive = 0;
+  search_t pipeline = {.rules_set = false}; /* rules given by -H */
+  choice_policy_t tie_break = choice_position;
+  engine_t engine = engine_backtrack;
+  uint64_t seed = rng_default_seed();
+  char *output_name = NULL;
+
+  while ((optc = getopt_long(argc, argv, "aAd:e:f:g::H:j:lno:P:r:Rs:t:uvVh",
+                             long_opts, NULL)) != -1)
+    switch (optc)
+    {
+      case 'a':
+        all = true;
+        break;
+
+      case 'A':
+        alldiff = true;
+        break;
+
+      case 'B':
+        packed = true;
+        all = true;
+        break;
+
+      case 'C':
+        count_only = true;
+        all = true;
+        break;
+
+      case 'D':
+        adaptive = (optarg != NULL) ? parse_ratio(optarg, "--adaptive")
+                                    : ADAPTIVE_RATIO;
+        break;
+
+      case 'H':
+        parse_rules(optarg, &pipeline);
+        break;
+
+      case 'h':
+        printf("Usage: sudoku [-a|-A|-d N|-e E|-f N|-H L|-j N|-l|-n|-P K|"
+               "-r P|-R|\n"
+               "                     -t P|-o FILE|-v|-V|-h] [FILE...]\n"
+               "       sudoku -g[SIZE] [-l|-n|-u|-s N|-o FILE|-v|-V|-h]\n"
+               "Solve or generate Sudoku grids of size: ");
+        print_sizes(stdout);
+        printf(
+            "\n"
+            "\n"
+            " -a,--all               search for all possible solutions\n"
+            " --adaptive[=R]         turn off the heuristics removing less "
+            "than R\n"
+            "                        candidates per microsecond at a depth "
+            "(default: %g)\n"
+            " --count                count the solutions without printing "
+            "them (implies -a)\n"
+            " -A,--alldiff           when the other heuristics stall, remove "
+            "the colors\n"
+            "                        left out by all-different filtering "
+            "(backtrack)\n"
+            " -d N,--max-depth N     give up branches deeper than N choices\n"
+            " --max-solutions K      stop after K solutions (implies -a)\n"
+            " -e E,--engine E        search with heuristics and backtracking "
+            "(backtrack,\n"
+            "                        default), with dancing links (dlx) or "
+            "with conflict\n"
+            "                        analysis, learning and restarts (cdcl)\n"
+            " -f N,--fish N          when the other heuristics stall, look "
+            "for fish of up\n"
+            "                        to N lines (2: X-Wing, 3: Swordfish, 4: "
+            "Jellyfish,\n"
+            "                        default: 0, none) (backtrack)\n"
+            " -g[N],--generate[N]    generate a grid of size NxN (default:9)\n"
+            " -H L,--heuristics L    apply the heuristics of the "
+            "comma-separated list L,\n"
+            "                        in this order, after cross-hatching: "
+            "singles, naked,\n"
+            "                        hidden, intersections, fish, alldiff "
+            "or none\n"
+            "                        (default: "
+            "singles,naked,hidden,intersections)\n"
+            " -j N,--jobs N          solve N files at once, N grids at once "
+            "with -l, or\n"
+            "                        search a single grid with N threads "
+            "(backtrack)\n"
+            " -l,--lines             read and write one grid per line of "
+            "NxN characters\n"
+            "                        ('.', '0' or '_' for empty cells), "
+            "with -v the\n"
+            "                        grids solved per second\n"
+            " -n,--numeric           read and write cells as numbers 1 to N "
+            "separated by\n"
+            "                        spaces ('_', '.' or 0 for empty cells), "
+            "needed above 64\n"
+            " --ordered              with -l and -j, write the solutions in "
+            "the order of\n"
+            "                        the grids (by default, as soon as they "
+            "are found)\n"
+            " --packed               write only the solutions, in binary: "
+            "for each grid a\n"
+            "                        header of 8 bytes, 'S' and the colors "
+            "on a few bits\n"
+            "                        for each solution, 'E' and their "
+            "number (implies -a)\n"
+            " -P K,--portfolio K     race K searches with various random "
+            "choices and\n"
+            "                        heuristics, the first solution wins "
+            "(backtrack)\n"
+            " -o FILE,--output FILE  write output to FILE "
+            "(appends the end of FILE if it already exists)\n"
+            " -r P[:N],--restarts P[:N]\n"
+            "                        make random choices, and start again "
+            "after N dead\n"
+            "                        ends (default: %d), N growing with the "
+            "policy P: luby,\n"
+            "                        geometric or none (backtrack)\n"
+            " -R,--random            make random choices (backtrack)\n"
+            " -s N,--seed N          seed of the random generator "
+            "(reproducible runs)\n"
+            " -t P,--tie-break P     among the cells with the fewest "
+            "candidates, choose\n"
+            "                        the first in reading order (position, "
+            "default),\n"
+            "                        any of them (first) or the most "
+            "constrained (degree)\n"
+            " -u,--unique            generate a grid with unique solution\n"
+            " -v,--verbose           verbose output\n"
+            " -V,--version           display version and exit\n"
+            " -h,--help              display this help and exit\n"
+            "\n"
+            "Without FILE, or when FILE is -, read the standard input.\n",
+            ADAPTIVE_RATIO, RESTART_BASE);
+        exit(EXIT_SUCCESS);
+
+      case 'd':
+        max_depth = parse_number(optarg, "-d", SIZE_MAX, 10);
+        break;
+
+      case 'e':
+        if (strcmp(optarg, "backtrack") == 0)
+        {
+          engine = engine_backtrack;
+        }
+        else if (strcmp(optarg, "dlx") == 0)
+        {
+          engine = engine_dlx;
+        }
+        else if (strcmp(optarg, "cdcl") == 0)
+        {
+          engine = engine_cdcl;
+        }
+        else
+        {
+          errx(EXIT_FAILURE, "Error: Unknown engine '%s', please choose "
+                             "backtrack, dlx or cdcl",
+               optarg);
+        }
+        break;
+
+      case 'f':
+        fish_order = parse_number(optarg, "-f", SIZE_MAX, 10);
+        if (fish_order == 1)
+        {
+          errx(EXIT_FAILURE, "Error: A fish has at least 2 lines");
+        }
+        break;
+
+      case 'g':
+        generator = true;
+        if (optarg)
+        {
+          size = parse_number(optarg, "-g", INT_MAX, 10);
+          if (!grid_check_size(size))
+          {
+            fprintf(stderr,
+                    "sudoku: Error: Please choose one of these sizes: ");
+            print_sizes(stderr);
+            fprintf(stderr, "\n");
+            exit(EXIT_FAILURE);
+          }
+        }
+        break;
+
+      case 'V':
+        printf("sudoku %d.%d.%d\nSolve/generate sudoku grids of size: ",
+               VERSION, SUBVERSION, REVISION);
+        print_sizes(stdout);
+        printf("\n");
+        exit(EXIT_SUCCESS);
+
+      case 'j':
+        threads = parse_number(optarg, "-j", SIZE_MAX, 10);
+        if (threads == 0)
+        {
+          errx(EXIT_FAILURE, "Error: Please choose at least one thread");
+        }
+        break;
+
+      case 'l':
+        lines = true;
+        break;
+
+      case 'M':
+        max_solutions =
+            parse_number(optarg, "--max-solutions", UINT64_MAX, 10);
+        if (max_solutions == 0)
+        {
+          errx(EXIT_FAILURE, "Error: Please choose at least one solution");
+        }
+        all = true;
+        break;
+
+      case 'n':
+        numeric = true;
+        break;
+
+      case 'O':
+        ordered = true;
+        break;
+
+      case 'o':
+        output_name = optarg; /* In case of multiple uses of '-o' */
+        break;
+
+      case 'P':
+        portfolio = parse_number(optarg, "-P", SIZE_MAX, 10);
+        break;
+
+      case 'r':
+        parse_restarts(optarg, &restart_policy, &restart_base);
+        random = true;
+        break;
+
+      case 'R':
+        random = true;
+        break;
+
+      case 's':
+        seed = parse_number(optarg, "-s", UINT64_MAX, 0);
+        break;
+
+      case 't':
+        if (strcmp(optarg, "position") == 0)
+        {
+          tie_break = choice_position;
+        }
+        else if (strcmp(optarg, "first") == 0)
+        {
+          tie_break = choice_first;
+        }
+        else if (strcmp(optarg, "degree") == 0)
+        {
+          tie_break = choice_degree;
+        }
+        else
+        {
+          errx(EXIT_FAILURE, "Error: Unknown tie-break policy '%s', please "
+                             "choose position, first or degree",
+               optarg);
+        }
+        break;
+
+      case 'v':
+        verbose = true;
+        break;
+
+      case 'u':
+        unique = true;
+        break;
+
+      default:
+        errx(EXIT_FAILURE,
+             "Error: You chose an unrecognized option: "
+             "'%s'.\n"
+             "Software is now closing.\n",
+             argv[optind - 1]);
+    }
+
+  if (output_name != NULL) /* Means '-o' has been used. */
+  {
+    output = fopen(output_name, "a");
+    if (output == NULL)
+    {
+      error = true;
+      warn("Error on output file %s", output_name);
+      output = stdout;
+    }
+  }
+
+  /* Streams of grids are written by big blocks, unless they are watched */
+  if (lines && !isatty(fileno(output)))
+  {
+    setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER);
+  }
+
+  if (output != stdout && !packed)
+  {
+    fprintf(output, "# Here is your software output:\n\n");
+  }
+
+  if (generator && all)
+  {
+    warnx("Warning: You are in GENERATOR mode and therefore, you can't"
+          " search for solutions. Option '-a/--all' has been disabled.\n");
+    all = false;
+    packed = false;
+  }
+
+  if (lines && numeric)
+  {
+    errx(EXIT_FAILURE, "Error: Grids on a single line are written with "
+                       "characters, options '-l' and '-n' cannot be mixed");
+  }
+
+  if (unique && !generator)
+  {
+    warnx("Warning: You are in SOLVER mode and therefore, you can't  "
+          "generate a grid. Option '-u/--unique' has been disabled.\n");
+    unique = false;
+  }
+
+  if (verbose)
+  {
+    FILE *report = packed ? stderr : output; /* keeps the stream packed */
+    fprintf(report, "# Colors backend: %s\n", colors_backend());
+    fprintf(report, "# Seed: %" PRIu64 "\n", seed);
+  }
+
+  rng_t rng;
+  rng_seed(&rng, seed);
+
+  if (!generator) /* User mode */
+  {
+    options_t options = {
+        .all = all,
+        .numeric = numeric,
+        .lines = lines,
+        .packed = packed,
+        .ordered = ordered,
+        .threads = lines ? threads : 1,
+        .verbose = verbose,
+        .search = {.engine = engine,
+                   .random = random,
+                   .tie_break = tie_break,
+                   .max_depth = max_depth,
+                   .threads = threads,
+                   .portfolio = portfolio,
+                   .fish_order = fish_order,
+                   .adaptive = adaptive,
+                   .restart_policy = restart_policy,
+                   .restart_base = restart_base,
+                   .count_only = count_only,
+                   .max_solutions = max_solutions}};
+    set_rules(&options.search, &pipeline, alldiff);
+
+    /* Each file has its own random stream, so that its search does not
+       depend on the files before it nor on the threads */
+    char *standard_input[] = {"-"}; /* without file */
+    char **files = (argc == optind) ? standard_input : argv + optind;
+    size_t jobs_count = (argc == optind) ? 1 : (size_t)(argc - optind);
+    job_t *jobs = calloc(jobs_count, sizeof(job_t));
+    if (jobs == NULL)
+    {
+      err(EXIT_FAILURE, "Error: Impossible to alloc the jobs");
+    }
+
+    for (size_t i = 0; i < jobs_count; i++)
+    {
+      jobs[i].file_name = files[i];
+      rng_split(&rng, &jobs[i].rng);
+    }
+
+    /* With several files, the threads of '-j' solve different files */
+    if (lines)
+    {
+      options.search.threads = 1; /* the threads solve different grids */
+    }
+
+    if (threads > 1 && jobs_count > 1 && !lines)
+    {
+      options.search.threads = 1;
+      batch_solve(&options, jobs, jobs_count, threads, output);
+    }
+    else
+    {
+      for (size_t i = 0; i < jobs_count; i++)
+      {
+        jobs[i].output = output;
+        solve_file(&options, &jobs[i]);
+      }
+    }
+
+    for (size_t i = 0; i < jobs_count; i++)
+    {
+      error |= jobs[i].error;
+    }
+    free(jobs);
 
     if (error)
     {
@@ -361,7 +1682,9 @@ int main(int argc, char *argv[])
   else /* Generator mode */
   {
     fprintf(output, "# Here is your generated grid:\n\n");
-    grid_t *gen_grid = grid_generation(size, unique);
+    grid_t *gen_grid = grid_generation(size, unique, &rng);
+    grid_set_numeric(gen_grid, numeric);
+    grid_set_line(gen_grid, lines);
     grid_print(gen_grid, output);
     grid_free(gen_grid);
   }
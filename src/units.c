@@ -0,0 +1,119 @@
+#include "units.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <math.h>
+#include <pthread.h>
+
+#include "grid.h"
+
+/* Tables already built, indexed by grid size. They are shared by all
+   threads, and only read once built. */
+static units_t *units_cache[MAX_GRID_SIZE + 1];
+static pthread_mutex_t units_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static units_t *units_build(const size_t size)
+{
+  size_t sqr = sqrt(size);
+  if (sqr * sqr != size)
+  {
+    return NULL;
+  }
+
+  units_t *units = malloc(sizeof(units_t));
+  if (units == NULL)
+  {
+    return NULL;
+  }
+
+  units->size = size;
+  units->sqr = sqr;
+  units->peers_count = 3 * size - 2 * sqr - 1;
+  units->units = malloc(3 * size * size * sizeof(cell_index_t));
+  units->cell_units = malloc(3 * size * size * sizeof(cell_index_t));
+  /* + 1 because a grid of size 1 has no peer at all */
+  units->peers =
+      malloc(units->peers_count * size * size * sizeof(cell_index_t) + 1);
+
+  if (units->units == NULL || units->cell_units == NULL ||
+      units->peers == NULL)
+  {
+    free(units->units);
+    free(units->cell_units);
+    free(units->peers);
+    free(units);
+    return NULL;
+  }
+
+  for (size_t row = 0; row < size; row++)
+  {
+    for (size_t column = 0; column < size; column++)
+    {
+      size_t cell = row * size + column;
+      size_t block = (row / sqr) * sqr + column / sqr;
+      size_t in_block = (row % sqr) * sqr + column % sqr;
+
+      units->units[row * size + column] = cell;
+      units->units[(size + column) * size + row] = cell;
+      units->units[(2 * size + block) * size + in_block] = cell;
+
+      units->cell_units[3 * cell] = row;
+      units->cell_units[3 * cell + 1] = size + column;
+      units->cell_units[3 * cell + 2] = 2 * size + block;
+    }
+  }
+
+  /* Peers: the row and the column, then the cells of the block which are in
+     neither of them */
+  for (size_t cell = 0; cell < size * size; cell++)
+  {
+    size_t row = cell / size;
+    size_t column = cell % size;
+    size_t block = 2 * size + (row / sqr) * sqr + column / sqr;
+    cell_index_t *peers = &units->peers[units->peers_count * cell];
+    size_t count = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+      if (i != column)
+      {
+        peers[count++] = row * size + i;
+      }
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      if (i != row)
+      {
+        peers[count++] = i * size + column;
+      }
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      size_t peer = units->units[block * size + i];
+      if (peer / size != row && peer % size != column)
+      {
+        peers[count++] = peer;
+      }
+    }
+  }
+
+  return units;
+}
+
+const units_t *units_get(const size_t size)
+{
+  if (size == 0 || size > MAX_GRID_SIZE)
+  {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&units_lock);
+  if (units_cache[size] == NULL)
+  {
+    units_cache[size] = units_build(size);
+  }
+  units_t *units = units_cache[size];
+  pthread_mutex_unlock(&units_lock);
+  return units;
+}
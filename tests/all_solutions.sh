@@ -0,0 +1,58 @@
+#!/bin/sh
+# Checks the searches in mode_all on a grid of 4158 solutions: with each
+# engine, -a prints the same solutions in the same order with -j 1 and
+# -j 4, the engines find the same solutions, and --count and
+# --max-solutions agree with -a.
+# Usage: tests/all_solutions.sh [SUDOKU] (default: ./sudoku)
+
+SUDOKU=${1:-./sudoku}
+TESTS=$(dirname "$0")
+GRID="$TESTS/loose.txt"
+SOLUTIONS=4158
+BOUND=100
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+status=0
+fail()
+{
+  echo "all_solutions: FAIL ($*)"
+  status=1
+}
+
+tr -d ' \n' < "$GRID" > "$dir/line" && echo >> "$dir/line"
+
+for engine in backtrack dlx cdcl
+do
+  "$SUDOKU" -a -e $engine -j 1 "$GRID" > "$dir/$engine" || fail "-e $engine"
+  if [ "$(grep -c '^Solution ' "$dir/$engine")" -ne $SOLUTIONS ]
+  then
+    fail "-e $engine: not $SOLUTIONS solutions"
+  fi
+
+  for jobs in 1 4
+  do
+    "$SUDOKU" -a -e $engine -j $jobs "$GRID" | cmp -s - "$dir/$engine" ||
+      fail "-a -e $engine -j $jobs differs from -j 1"
+
+    count=$("$SUDOKU" --count -e $engine -j $jobs "$GRID" | tail -n 1)
+    [ "$count" = "$SOLUTIONS solution(s) found" ] ||
+      fail "--count -e $engine -j $jobs: $count"
+
+    "$SUDOKU" --max-solutions $BOUND -e $engine -j $jobs "$GRID" \
+      > "$dir/bounded"
+    if [ "$(grep -c '^Solution ' "$dir/bounded")" -ne $BOUND ] ||
+       [ "$(tail -n 1 "$dir/bounded")" != "$BOUND solution(s) found" ]
+    then
+      fail "--max-solutions $BOUND -e $engine -j $jobs"
+    fi
+  done
+
+  "$SUDOKU" -l -a -e $engine "$dir/line" | sort > "$dir/$engine.sorted"
+  cmp -s "$dir/$engine.sorted" "$dir/backtrack.sorted" ||
+    fail "-e $engine finds other solutions than -e backtrack"
+done
+
+[ $status -eq 0 ] && echo "all_solutions: OK"
+exit $status
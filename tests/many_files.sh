@@ -0,0 +1,30 @@
+#!/bin/sh
+# Solves more grid files than open descriptors are allowed, each file must be
+# closed once its grid is read.
+# Usage: tests/many_files.sh [SUDOKU] (default: ./sudoku)
+
+SUDOKU=${1:-./sudoku}
+FILES=100
+LIMIT=64
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+"$SUDOKU" -g9 -o "$dir/grid.txt" || exit 1
+i=0
+while [ $i -lt $FILES ]
+do
+  cp "$dir/grid.txt" "$dir/g$i.txt"
+  i=$((i + 1))
+done
+rm "$dir/grid.txt"
+
+for jobs in 1 4
+do
+  if ! (ulimit -n $LIMIT && "$SUDOKU" -j $jobs "$dir"/g*.txt > /dev/null)
+  then
+    echo "many_files: FAIL ($FILES files, -j $jobs, ulimit -n $LIMIT)"
+    exit 1
+  fi
+done
+echo "many_files: OK"
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Checks that the --packed stream holds the solutions of -l -a, on grids of
+# size 9 and 25, alone and through the pipeline of --ordered -j 3.
+# Usage: tests/packed.sh [SUDOKU] (default: ./sudoku)
+
+SUDOKU=${1:-./sudoku}
+TESTS=$(dirname "$0")
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+status=0
+for grids in "$TESTS/loose9.txt" "$TESTS/loose25.txt"
+do
+  for options in "" "--ordered -j 3"
+  do
+    "$SUDOKU" -l -a $options "$grids" > "$dir/text" &&
+      "$SUDOKU" -l --packed $options "$grids" > "$dir/packed" &&
+      sh "$TESTS/unpack.sh" < "$dir/packed" > "$dir/unpacked" &&
+      cmp -s "$dir/text" "$dir/unpacked"
+    if [ $? -ne 0 ]
+    then
+      echo "packed: FAIL ($(basename "$grids") $options)"
+      status=1
+    fi
+  done
+done
+
+[ $status -eq 0 ] && echo "packed: OK"
+exit $status
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Checks the pipeline of -l -j on more grids than it has slots, with a line
+# which is not a grid and a grid which is not consistent: --ordered prints
+# the same lines as a single solver, and without it the same lines in any
+# order.
+# Usage: tests/pipeline.sh [SUDOKU] (default: ./sudoku)
+
+SUDOKU=${1:-./sudoku}
+TESTS=$(dirname "$0")
+GRIDS="$TESTS/grids9.txt"
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+status=0
+fail()
+{
+  echo "pipeline: FAIL ($*)"
+  status=1
+}
+
+# The file has errors: the status of sudoku is not checked
+"$SUDOKU" -l "$GRIDS" > "$dir/single" 2> /dev/null
+[ "$(wc -l < "$dir/single")" -eq "$(wc -l < "$GRIDS")" ] ||
+  fail "-l: not one line per grid"
+sort "$dir/single" > "$dir/single.sorted"
+
+for run in 1 2 3
+do
+  "$SUDOKU" -l -j 3 --ordered "$GRIDS" 2> /dev/null |
+    cmp -s - "$dir/single" || fail "-l -j 3 --ordered, run $run"
+
+  "$SUDOKU" -l -j 3 "$GRIDS" 2> /dev/null | sort |
+    cmp -s - "$dir/single.sorted" || fail "-l -j 3, run $run"
+done
+
+[ $status -eq 0 ] && echo "pipeline: OK"
+exit $status
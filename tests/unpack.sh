@@ -0,0 +1,85 @@
+#!/bin/sh
+# Decodes the --packed stream read on the standard input, and prints it as
+# the text of -l -a: one solution per line, then the number of solutions of
+# the grid. Exits with an error on a malformed stream.
+
+od -An -v -tu1 | awk '
+BEGIN {
+  table = "123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ@abcdefghijklmnopqrstuvwxyz&*"
+  for (i = 0; i < 8; i++)
+  {
+    power[i] = 2 ^ i
+  }
+}
+{
+  for (i = 1; i <= NF; i++)
+  {
+    byte[count++] = $i
+  }
+}
+function fail(message)
+{
+  print "unpack: " message " at byte " at > "/dev/stderr"
+  exit 1
+}
+END {
+  at = 0
+  while (at < count)
+  {
+    if (at + 8 > count || byte[at] != 83 || byte[at + 1] != 68 ||
+        byte[at + 2] != 75 || byte[at + 3] != 80)
+    {
+      fail("no header")
+    }
+    if (byte[at + 4] != 1 || byte[at + 7] != 0)
+    {
+      fail("unknown version")
+    }
+    size = byte[at + 5]
+    bits = byte[at + 6]
+    record = int((size * size * bits + 7) / 8)
+    at += 8
+
+    solutions = 0
+    while (at < count && byte[at] == 83) # S
+    {
+      if (at + 1 + record > count)
+      {
+        fail("truncated solution")
+      }
+      line = ""
+      for (cell = 0; cell < size * size; cell++)
+      {
+        color = 0
+        for (b = 0; b < bits; b++)
+        {
+          k = cell * bits + b
+          if (int(byte[at + 1 + int(k / 8)] / power[k % 8]) % 2)
+          {
+            color += power[b]
+          }
+        }
+        line = line substr(table, color + 1, 1)
+      }
+      print line
+      solutions++
+      at += 1 + record
+    }
+
+    if (at + 9 > count || byte[at] != 69) # E
+    {
+      fail("no end of grid")
+    }
+    number = 0
+    for (i = 8; i >= 1; i--)
+    {
+      number = number * 256 + byte[at + i]
+    }
+    if (number != solutions)
+    {
+      fail("count " number " for " solutions " solutions")
+    }
+    print "# " number " solution(s) found"
+    at += 9
+  }
+}'